@@ -0,0 +1,32 @@
+
+#ifndef AFFINITY_H
+#define AFFINITY_H
+
+#include <pthread.h>
+
+/* Placement policies of simulator threads on host CPUs */
+#define AFFINITY_SPREAD	1 /* One physical core each, SMT siblings last */
+#define AFFINITY_PACK	2 /* Fill all SMT siblings of a core first */
+
+/* Simulator threads which can be pinned */
+enum aff_role {
+	AFF_TIMER,
+	AFF_LOADER,
+	AFF_CPU
+};
+
+/* Read the host topology from sysfs and order the host CPUs this process
+ * may run on according to [policy]. Return the number of host CPUs */
+int affinity_init(int policy);
+
+/* Pin [thread] playing [role] (simulated CPU [id] for AFF_CPU) to its
+ * host CPU and report the choice on stderr. The timer and the loader share
+ * the first host CPU, simulated CPU i gets the (i + 1)-th one, wrapping
+ * around when there are more threads than host CPUs.
+ * Return the host CPU, -1 if the thread could not be pinned */
+int affinity_pin(pthread_t thread, enum aff_role role, int id);
+
+void affinity_finish(void);
+
+#endif
+
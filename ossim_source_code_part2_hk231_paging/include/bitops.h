@@ -1,3 +1,6 @@
+#ifndef BITOPS_H
+#define BITOPS_H
+
 #ifdef CONFIG_64BIT
 #define BITS_PER_LONG 64
 #else
@@ -35,3 +38,75 @@
 #define NBITS(n) (n==0?0:NBITS32(n))
 
 #define EXTRACT_NBITS(nr, h, l) ((nr&GENMASK(h,l)) >> l)
+
+/*
+ * Word-packed bitmaps. BITS_PER_LONG above follows CONFIG_64BIT and is
+ * used by GENMASK on 32-bit values, so bitmap words are sized from the
+ * host unsigned long instead (the same way BITS_TO_LONGS does).
+ */
+#define BITMAP_WORD_BITS        (BITS_PER_BYTE * sizeof(unsigned long))
+#define BITMAP_WORD(nr)         ((nr) / BITMAP_WORD_BITS)
+#define BITMAP_MASK(nr)         (1UL << ((nr) % BITMAP_WORD_BITS))
+
+static inline void __set_bit(int nr, unsigned long *addr)
+{
+	addr[BITMAP_WORD(nr)] |= BITMAP_MASK(nr);
+}
+
+static inline void __clear_bit(int nr, unsigned long *addr)
+{
+	addr[BITMAP_WORD(nr)] &= ~BITMAP_MASK(nr);
+}
+
+static inline int test_bit(int nr, const unsigned long *addr)
+{
+	return (addr[BITMAP_WORD(nr)] & BITMAP_MASK(nr)) != 0;
+}
+
+/* __ffs - index of the least significant set bit, @word must not be 0 */
+static inline int __ffs(unsigned long word)
+{
+	return __builtin_ctzl(word);
+}
+
+/* __fls - index of the most significant set bit, @word must not be 0 */
+static inline int __fls(unsigned long word)
+{
+	return BITMAP_WORD_BITS - 1 - __builtin_clzl(word);
+}
+
+/*
+ * find_first_bit - first set bit of a bitmap
+ * Return @size when no bit is set
+ */
+static inline int find_first_bit(const unsigned long *addr, int size)
+{
+	int idx;
+	for (idx = 0; idx * (int)BITMAP_WORD_BITS < size; idx++) {
+		if (addr[idx]) {
+			int nr = idx * BITMAP_WORD_BITS + __ffs(addr[idx]);
+			return (nr < size) ? nr : size;
+		}
+	}
+	return size;
+}
+
+/*
+ * find_first_and_bit - first bit set in both @addr1 and @addr2
+ * Return @size when there is none
+ */
+static inline int find_first_and_bit(const unsigned long *addr1,
+				     const unsigned long *addr2, int size)
+{
+	int idx;
+	for (idx = 0; idx * (int)BITMAP_WORD_BITS < size; idx++) {
+		unsigned long word = addr1[idx] & addr2[idx];
+		if (word) {
+			int nr = idx * BITMAP_WORD_BITS + __ffs(word);
+			return (nr < size) ? nr : size;
+		}
+	}
+	return size;
+}
+
+#endif /* BITOPS_H */
@@ -3,6 +3,7 @@
 
 /* Define structs and routine could be used by every source files */
 
+#include <stddef.h>
 #include <stdint.h>
 
 #ifndef OSCFG_H
@@ -28,7 +29,10 @@ enum ins_opcode_t {
 	ALLOC,	// Allocate memory
 	FREE,	// Deallocated a memory block
 	READ,	// Write data to a byte on memory
-	WRITE	// Read data from a byte on memory
+	WRITE,	// Read data from a byte on memory
+	COPY,	// Copy a range of bytes between two regions
+	FILL,	// Set a range of bytes to one value
+	COMPARE	// Compare ranges of bytes of two regions
 };
 
 /* instructions executed by the CPU */
@@ -37,11 +41,27 @@ struct inst_t {
 	uint32_t arg_0; // Argument lists for instructions
 	uint32_t arg_1;
 	uint32_t arg_2;
+	uint32_t arg_3;
+	uint32_t arg_4;
+};
+
+/* Pre-decoded instruction, op is the address of its handler in the
+ * interpreter. A CALC holds in arg_0 the length of the CALC run it starts */
+struct dinst_t {
+	const void * op;
+	uint32_t arg_0;
+	uint32_t arg_1;
+	uint32_t arg_2;
+	uint32_t arg_3;
+	uint32_t arg_4;
 };
 
 struct code_seg_t {
 	struct inst_t * text;
 	uint32_t size;
+	struct dinst_t * decoded; // Built by the CPU on first run
+	void * image;	// Mapped image text points into, NULL if text is malloc'd
+	size_t image_len;
 };
 
 struct trans_table_t {
@@ -67,6 +87,25 @@ struct page_table_t {
 // Each page containing a segment value "v_index" and a pointer
 // to a page having that segment value.
 
+/* Node of the virtual runtime tree of the fair scheduler */
+struct fair_node {
+	uint64_t vruntime;	// Weighted time slots this process has run
+	uint64_t seq;		// Enqueue order, breaks vruntime ties
+	struct fair_node * left;
+	struct fair_node * right;
+	int height;
+};
+
+/* Scheduling history of a process, in time slots */
+struct proc_stats {
+	uint64_t arrival;	// Added to the scheduler
+	uint64_t first_run;	// First dispatched
+	uint64_t ready;		// Last put in a run queue
+	uint64_t wait;		// Total time spent in run queues
+	uint64_t finish;
+	uint32_t nr_dispatch;
+};
+
 /* PCB, describe information about a process */
 struct pcb_t {
 	uint32_t pid;	// PID
@@ -87,6 +126,8 @@ struct pcb_t {
 #endif
 	struct page_table_t * page_table; // Page table
 	uint32_t bp;	// Break pointer
+	struct fair_node fair; // Fair scheduler bookkeeping
+	struct proc_stats stats; // Filled with SCHED_STATS only
 
 };
 
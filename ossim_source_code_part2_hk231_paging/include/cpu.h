@@ -5,9 +5,17 @@
 #include "common.h"
 
 /* Execute an instruction of a process. Return 0
- * if the instruction is executed successfully.
- * Otherwise, return 1. */
+ * if an instruction is executed, 1 at the end of its code. */
 int run(struct pcb_t * proc);
 
+#ifndef CPU_IPC
+#define CPU_IPC 1
+#endif
+
+/* Execute up to [budget] instructions of a process, stopping early at the
+ * end of its code. Return the number of instructions executed. The code
+ * is decoded on the first call, a [budget] of 0 only decodes it */
+int run_slice(struct pcb_t * proc, int budget);
+
 #endif
 
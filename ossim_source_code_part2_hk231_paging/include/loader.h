@@ -3,7 +3,47 @@
 
 #include "common.h"
 
+/*
+ * Binary process image: a header followed by the instructions, laid out
+ * exactly as struct inst_t so the loader can map the file and use it as
+ * the code segment without parsing or copying. Images are only portable
+ * between hosts of the same ABI. load() accepts both images and the text
+ * format, images are recognized by their magic number.
+ */
+#define PROC_IMAGE_MAGIC	0x4d49534fU	// "OSIM"
+#define PROC_IMAGE_VERSION	2
+
+struct proc_image_hdr {
+	uint32_t magic;
+	uint32_t version;
+	uint32_t priority;
+	uint32_t size;	// Number of instructions following the header
+};
+
+/* Create a process running the program at [path]. Processes running the
+ * same program share one read-only code segment */
 struct pcb_t * load(const char * path);
 
+/* load() in two steps. load_code reads the program and may be called from
+ * several threads at once, load_proc creates the process and takes over
+ * the reference to [code] */
+struct code_seg_t * load_code(const char * path);
+struct pcb_t * load_proc(struct code_seg_t * code);
+
+/* Tear down a finished process: its memory, frames and swap slots, its
+ * reference to the code. The PCB is kept for a later load_proc */
+void free_proc(struct pcb_t * proc);
+
+/* Take one more reference to [code], for a caller that creates several
+ * processes from one load_code */
+void hold_code(struct code_seg_t * code);
+
+/* Drop the reference of a finished process to its code segment, the
+ * segment is freed with its last user */
+void put_code(struct code_seg_t * code);
+
+/* Write the code of [proc] as an image to [path]. Returns -1 on error */
+int save_image(struct pcb_t * proc, const char * path);
+
 #endif
 
@@ -0,0 +1,40 @@
+
+#ifndef LOG_H
+#define LOG_H
+
+#include <stdint.h>
+
+#ifndef OSCFG_H
+#include "os-cfg.h"
+#endif
+
+/*
+ * Simulator output.
+ * With LOG_ASYNC every thread formats its records into a private ring
+ * buffer, without any lock. A writer thread collects the rings and prints
+ * the records of a time slot once the slot is over, ordered by time slot
+ * and then by the order in which they were logged. Without LOG_ASYNC the
+ * records go straight to stdout. LOG_OFF compiles all logging out.
+ */
+
+#ifdef LOG_OFF
+#define log_printf(...)		((void)0)
+#define log_write(buf, len)	((void)0)
+#define log_start()		((void)0)
+#define log_stop()		((void)0)
+#else
+/* Log a formatted record, same format as printf */
+void log_printf(const char * fmt, ...) __attribute__((format(printf, 1, 2)));
+
+/* Log [len] raw bytes */
+void log_write(const char * buf, int len);
+
+/* Start the writer thread. Records logged before are printed directly */
+void log_start(void);
+
+/* Print every pending record and stop the writer thread */
+void log_stop(void);
+#endif
+
+#endif
+
@@ -0,0 +1,52 @@
+
+#ifndef MM_TLB_H
+#define MM_TLB_H
+
+#include <stdint.h>
+
+#ifndef OSCFG_H
+#include "os-cfg.h"
+#endif
+
+/*
+ * Software TLB.
+ * With MM_TLB set to a power of two, every simulated CPU caches that many
+ * translations from (pid, pgn) to a frame of MEMRAM, direct-mapped. A
+ * thread uses the TLB of the CPU it last passed to tlb_set_cpu, a thread
+ * that never did runs without TLB. An entry is one 64-bit word, so a CPU
+ * can drop the entry of another one without locking. Whoever changes a
+ * PTE of a page that may be in RAM calls tlb_invalidate for it.
+ */
+
+struct tlb_stat {
+	unsigned long hits;
+	unsigned long misses;
+};
+
+#ifdef MM_TLB
+/* Allocate an empty TLB for each of [num_cpus] CPUs */
+void tlb_init(int num_cpus);
+/* Use the TLB of CPU [cpu] in the calling thread */
+void tlb_set_cpu(int cpu);
+/* Translate [pgn] of process [pid], returns 1 and sets [fpn] on a hit */
+int tlb_lookup(uint32_t pid, uint32_t pgn, int * fpn);
+/* Cache the translation of [pgn] of process [pid] to [fpn] */
+void tlb_insert(uint32_t pid, uint32_t pgn, int fpn);
+/* Drop the translation of [pgn] of process [pid] from every TLB */
+void tlb_invalidate(uint32_t pid, uint32_t pgn);
+/* Counters of CPU [cpu] */
+struct tlb_stat tlb_get_stat(int cpu);
+/* Free the TLBs, with MM_TLB_STATS print the counters of every CPU to
+ * stderr first */
+void tlb_finish(void);
+#else
+#define tlb_init(num_cpus)		((void)0)
+#define tlb_set_cpu(cpu)		((void)0)
+#define tlb_lookup(pid, pgn, fpn)	(0)
+#define tlb_insert(pid, pgn, fpn)	((void)0)
+#define tlb_invalidate(pid, pgn)	((void)0)
+#define tlb_finish()			((void)0)
+#endif
+
+#endif
+
@@ -0,0 +1,58 @@
+
+#ifndef MM_TRACE_H
+#define MM_TRACE_H
+
+#include <stdint.h>
+
+#ifndef OSCFG_H
+#include "os-cfg.h"
+#endif
+
+/*
+ * Memory access trace.
+ * With MM_TRACE set to a file name, every access of a process to a page
+ * appends one record to the trace. Records are buffered per thread and
+ * written in chunks, so within a time slot records of different CPUs may
+ * come in any order but the records of one CPU stay in order. mmreplay
+ * runs a trace through page replacement policies offline.
+ */
+
+#define MM_TRACE_MAGIC		0x5254534fU	// "OSTR"
+#define MM_TRACE_VERSION	1
+
+enum mm_trace_op {
+	MM_TRACE_READ,
+	MM_TRACE_WRITE
+};
+
+struct mm_trace_hdr {
+	uint32_t magic;
+	uint32_t version;
+	uint32_t rec_size;	// sizeof(struct mm_trace_rec)
+	uint32_t page_size;
+};
+
+struct mm_trace_rec {
+	uint32_t slot;
+	uint32_t pid;
+	uint32_t pgn;
+	uint16_t off;
+	uint8_t op;	// enum mm_trace_op
+	uint8_t pad;
+};
+
+#ifdef MM_TRACE
+/* Open the trace file [path], returns -1 on error */
+int mm_trace_start(const char * path);
+/* Record an access of process [pid] to page [pgn] */
+void mm_trace(uint32_t pid, uint32_t pgn, uint32_t off, enum mm_trace_op op);
+/* Write every buffered record and close the trace */
+void mm_trace_stop(void);
+#else
+#define mm_trace_start(path)		(0)
+#define mm_trace(pid, pgn, off, op)	((void)0)
+#define mm_trace_stop()			((void)0)
+#endif
+
+#endif
+
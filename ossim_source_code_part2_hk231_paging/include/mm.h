@@ -11,7 +11,16 @@
 
 #define PAGING_MEMSWPSZ BIT(14) /* 16MB */
 #define PAGING_SWPFPN_OFFSET 5  
-#define PAGING_MAX_PGN  (DIV_ROUND_UP(PAGING_CPU_BUS_WIDTH,PAGING_PAGESZ))
+#define PAGING_MAX_PGN  (BIT(PAGING_CPU_BUS_WIDTH) / PAGING_PAGESZ)
+
+/* Page table: a directory of PAGING_PGD_SZ leaf tables of PAGING_PTBL_SZ
+ * PTEs. The directory and the leaves are allocated on the first mapping
+ * of one of their pages */
+#define PAGING_PTBL_BITS 6
+#define PAGING_PTBL_SZ  BIT(PAGING_PTBL_BITS)
+#define PAGING_PGD_SZ   DIV_ROUND_UP(PAGING_MAX_PGN, PAGING_PTBL_SZ)
+#define PAGING_PGD_IDX(pgn)  ((pgn) >> PAGING_PTBL_BITS)
+#define PAGING_PTBL_IDX(pgn) ((pgn) & (PAGING_PTBL_SZ - 1))
 
 #define PAGING_SBRK_INIT_SZ PAGING_PAGESZ
 /* PTE BIT */
@@ -96,11 +105,14 @@ struct vm_rg_struct * init_vm_rg(int rg_start, int rg_endi);
 int enlist_vm_rg_node(struct vm_rg_struct **rglist, struct vm_rg_struct* rgnode);
 int enlist_pgn_node(struct pgn_t **pgnlist, int pgn);
 int vmap_page_range(struct pcb_t *caller, int addr, int pgnum, 
-                    struct framephy_struct *frames, struct vm_rg_struct *ret_rg);
+                    int *frames, struct vm_rg_struct *ret_rg);
 int vm_map_ram(struct pcb_t *caller, int astart, int send, int mapstart, int incpgnum, struct vm_rg_struct *ret_rg);
-int alloc_pages_range(struct pcb_t *caller, int incpgnum, struct framephy_struct **frm_lst);
+int alloc_pages_range(struct pcb_t *caller, int incpgnum, int *frames);
 int __swap_cp_page(struct memphy_struct *mpsrc, int srcfpn,
                 struct memphy_struct *mpdst, int dstfpn) ;
+uint32_t *pte_get(struct mm_struct *mm, int pgn);
+uint32_t *pte_alloc(struct mm_struct *mm, int pgn);
+void pgtbl_free(struct mm_struct *mm);
 int pte_set_fpn(uint32_t *pte, int fpn);
 int pte_set_swap(uint32_t *pte, int swptyp, int swpoff);
 int init_pte(uint32_t *pte,
@@ -114,7 +126,13 @@ int __alloc(struct pcb_t *caller, int vmaid, int rgid, int size, int *alloc_addr
 int __free(struct pcb_t *caller, int vmaid, int rgid);
 int __read(struct pcb_t *caller, int vmaid, int rgid, int offset, BYTE *data);
 int __write(struct pcb_t *caller, int vmaid, int rgid, int offset, BYTE value);
+int __copy(struct pcb_t *caller, int vmaid, int srcid, int srcoff,
+           int dstid, int dstoff, int size);
+int __fill(struct pcb_t *caller, int vmaid, int rgid, int offset, int size, BYTE value);
+int __compare(struct pcb_t *caller, int vmaid, int aid, int aoff,
+              int bid, int boff, int size, int *result);
 int init_mm(struct mm_struct *mm, struct pcb_t *caller);
+int free_mm(struct mm_struct *mm, struct pcb_t *caller);
 
 /* VM prototypes */
 int pgalloc(struct pcb_t *proc, uint32_t size, uint32_t reg_index);
@@ -129,21 +147,57 @@ int pgwrite(
 		BYTE data, // Data to be wrttien into memory
 		uint32_t destination, // Index of destination register
 		uint32_t offset);
+int pgcopy(
+		struct pcb_t * proc, // Process executing the instruction
+		uint32_t source, // Index of source register
+		uint32_t srcoff, // Source address = [source] + [srcoff]
+		uint32_t destination, // Index of destination register
+		uint32_t dstoff, // Destination address = [destination] + [dstoff]
+		uint32_t size);
+int pgfill(
+		struct pcb_t * proc, // Process executing the instruction
+		uint32_t destination, // Index of destination register
+		uint32_t offset, // Destination address = [destination] + [offset]
+		uint32_t size,
+		BYTE data);
+int pgcompare(
+		struct pcb_t * proc, // Process executing the instruction
+		uint32_t first, // Index of the first register
+		uint32_t firstoff, // First address = [first] + [firstoff]
+		uint32_t second, // Index of the second register
+		uint32_t secondoff, // Second address = [second] + [secondoff]
+		uint32_t size);
 /* Local VM prototypes */
 struct vm_rg_struct * get_symrg_byid(struct mm_struct* mm, int rgid);
 int validate_overlap_vm_area(struct pcb_t *caller, int vmaid, int vmastart, int vmaend);
 int get_free_vmrg_area(struct pcb_t *caller, int vmaid, int size, struct vm_rg_struct *newrg);
 int inc_vma_limit(struct pcb_t *caller, int vmaid, int inc_sz);
 int find_victim_page(struct mm_struct* mm, int *pgn);
+int pg_getpage(struct mm_struct *mm, int pgn, int *fpn, struct pcb_t *caller);
+int pg_getval(struct mm_struct *mm, int addr, BYTE *data, struct pcb_t *caller);
+int pg_setval(struct mm_struct *mm, int addr, BYTE value, struct pcb_t *caller);
+int free_pcb_memph(struct pcb_t *caller);
 struct vm_area_struct *get_vma_by_num(struct mm_struct *mm, int vmaid);
 
 /* MEM/PHY protypes */
+int MEMPHY_format(struct memphy_struct *mp, int pagesz);
 int MEMPHY_get_freefp(struct memphy_struct *mp, int *fpn);
 int MEMPHY_put_freefp(struct memphy_struct *mp, int fpn);
+int MEMPHY_get_freefp_order(struct memphy_struct *mp, int order, int *fpn);
+int MEMPHY_put_freefp_order(struct memphy_struct *mp, int fpn, int order);
+int MEMPHY_get_freefp_range(struct memphy_struct *mp, int n, int *fpns);
+int MEMPHY_put_freefp_range(struct memphy_struct *mp, int n, const int *fpns);
+int MEMPHY_nr_free(struct memphy_struct *mp);
+int MEMPHY_nr_used(struct memphy_struct *mp);
 int MEMPHY_read(struct memphy_struct * mp, int addr, BYTE *value);
 int MEMPHY_write(struct memphy_struct * mp, int addr, BYTE data);
+int MEMPHY_copy(struct memphy_struct *mp, int dst, int src, int len);
+int MEMPHY_fill(struct memphy_struct *mp, int addr, BYTE value, int len);
+int MEMPHY_compare(struct memphy_struct *mp, int a, int b, int len, int *result);
 int MEMPHY_dump(struct memphy_struct * mp);
 int init_memphy(struct memphy_struct *mp, int max_size, int randomflg);
+int free_memphy(struct memphy_struct *mp);
+void MEMPHY_dump_frag(struct memphy_struct *mp, const char *name);
 /* DEBUG */
 int print_list_fp(struct framephy_struct *fp);
 int print_list_rg(struct vm_rg_struct *rg);
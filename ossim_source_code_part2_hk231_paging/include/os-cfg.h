@@ -3,11 +3,27 @@
 
 #define MLQ_SCHED 1
 #define MAX_PRIO 140
+#define SCHED_PERCPU_RQ 1 /* One run queue per CPU with work stealing */
+//#define TIMER_WARP 1 /* Skip time slots in which every CPU is idle */
+//#define SIM_LOCKSTEP 1 /* Step all CPUs and the loader in one thread */
+#define CPU_IPC 1 /* Instructions a CPU executes in a time slot */
+#define LD_WORKERS 4 /* Threads reading programs before the simulation */
+/* Pin the timer, loader and CPU threads to host CPUs following the host
+ * topology: 1 = one physical core per thread, 2 = pack on SMT siblings */
+//#define CPU_AFFINITY 1
+/* Dump per-process scheduling metrics, JSON if the name ends with .json */
+//#define SCHED_STATS "sched_stats.csv"
 
 #define MM_PAGING
 //#define MM_FIXED_MEMSZ
 //#define VMDBG 1
 //#define MMDBG 1
+//#define MM_TRACE "mm.trace" /* Record page accesses for mmreplay */
+#define MM_TLB 64 /* Translations cached per CPU, power of two */
+//#define MM_TLB_STATS 1 /* Print the TLB hits and misses per CPU at exit */
+//#define MM_FRAG_STATS 1 /* Print the free frame runs of RAM at exit */
+#define LOG_ASYNC 1 /* Per-thread log buffers drained by a writer thread */
+//#define LOG_OFF 1 /* Compile all simulator output out */
 #define IODUMP 1
 #define PAGETBL_DUMP 1
 
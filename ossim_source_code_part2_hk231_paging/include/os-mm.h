@@ -1,9 +1,12 @@
 #ifndef OSMM_H
 #define OSMM_H
 
+#include <pthread.h>
+
 #define MM_PAGING
 #define PAGING_MAX_MMSWP 4 /* max number of supported swapped space */
 #define PAGING_MAX_SYMTBL_SZ 30
+#define MEMPHY_MAX_ORDER 10 /* Largest run of frames is 2^10 */
 
 typedef char BYTE;
 typedef uint32_t addr_t;
@@ -46,7 +49,7 @@ struct vm_area_struct {
  * Memory management struct
  */
 struct mm_struct {
-   uint32_t *pgd;
+   uint32_t **pgd; /* Page directory, see pte_get */
 
    struct vm_area_struct *mmap;
 
@@ -77,9 +80,14 @@ struct memphy_struct {
    int rdmflg;
    int cursor;
 
-   /* Management structure */
-   struct framephy_struct *free_fp_list;
-   struct framephy_struct *used_fp_list;
+   /* Buddy allocator, see MEMPHY_format. Block i of order k is the
+    * frames [i << k, (i + 1) << k) */
+   unsigned long *free_map[MEMPHY_MAX_ORDER + 1]; /* Set bit = free block */
+   int nr_blocks[MEMPHY_MAX_ORDER + 1]; /* Free blocks per order */
+   int hint[MEMPHY_MAX_ORDER + 1];      /* No free block in words before */
+   int nr_frames;
+   int nr_free;
+   pthread_mutex_t lock;
 };
 
 #endif
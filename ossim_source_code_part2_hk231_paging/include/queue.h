@@ -4,14 +4,24 @@
 
 #include "common.h"
 
-#define MAX_QUEUE_SIZE 10
+/* Initial capacity of a queue, it doubles whenever the queue is full.
+ * Must be a power of two */
+#define QUEUE_INIT_SIZE 16
 
+/* Ring buffer of PCBs: proc[head] is the oldest entry, the entries live
+ * in proc[(head + i) & (capacity - 1)] for i = 0 .. size - 1 */
 struct queue_t {
-	struct pcb_t * proc[MAX_QUEUE_SIZE];
+	struct pcb_t ** proc;
+	int head;
 	int size;
+	int capacity;
 	int time_slot;
 };
 
+void init_queue(struct queue_t * q);
+
+void free_queue(struct queue_t * q);
+
 void enqueue(struct queue_t * q, struct pcb_t * proc);
 
 struct pcb_t * dequeue(struct queue_t * q);
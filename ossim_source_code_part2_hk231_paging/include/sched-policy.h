@@ -0,0 +1,34 @@
+
+#ifndef SCHED_POLICY_H
+#define SCHED_POLICY_H
+
+#include "common.h"
+
+/*
+ * Scheduling policy operations. Every run queue keeps its own instance of
+ * the policy state, created by init_rq. pick_next, put_prev and
+ * enqueue_new are called with the run queue locked. tick is called
+ * without any lock by the CPU running [proc].
+ */
+struct sched_policy {
+	const char * name;
+	void * (*init_rq)(void);
+	void (*free_rq)(void * rq);
+	/* Remove and return the next process to run, NULL if none */
+	struct pcb_t * (*pick_next)(void * rq);
+	/* Take back a process which has used up its time slice */
+	void (*put_prev)(void * rq, struct pcb_t * proc);
+	/* Take a newly loaded process */
+	void (*enqueue_new)(void * rq, struct pcb_t * proc);
+	/* [proc] has run for one more time slot. May be NULL */
+	void (*tick)(struct pcb_t * proc);
+};
+
+extern const struct sched_policy fifo_policy;
+#ifdef MLQ_SCHED
+extern const struct sched_policy mlq_policy;
+#endif
+extern const struct sched_policy fair_policy;
+
+#endif
+
@@ -1,5 +1,5 @@
-#ifndef QUEUE_H
-#define QUEUE_H
+#ifndef SCHED_H
+#define SCHED_H
 
 #include "common.h"
 
@@ -7,22 +7,38 @@
 #define MLQ_SCHED
 #endif
 
+#ifndef MAX_PRIO
 #define MAX_PRIO 139
+#endif
 
 int queue_empty(void);
 
-void init_scheduler(void);
+/* Select the scheduling policy by name: "mlq", "fifo" or "fair" (also
+ * "cfs"). Must be called before init_scheduler. Returns -1 if there is
+ * no such policy. The default is mlq, or fifo without MLQ_SCHED */
+int sched_set_policy(const char * name);
+const char * sched_policy_name(void);
+
+/* Create [num_rqs] run queues. CPU [cpu] owns run queue (cpu % num_rqs),
+ * so num_rqs = 1 gives back the single global queue design and
+ * num_rqs = num_cpus gives one private queue per CPU.
+ * When [threaded] is 0 all calls come from a single thread and the run
+ * queues are not locked */
+void init_scheduler(int num_rqs, int threaded);
 void finish_scheduler(void);
 
-/* Get the next process from ready queue */
-struct pcb_t * get_proc(void);
+/* Get the next process from the ready queue of CPU [cpu]. When that
+ * queue is empty, steal a process from another CPU */
+struct pcb_t * get_proc(int cpu);
 
-/* Put a process back to run queue */
-void put_proc(struct pcb_t * proc);
+/* Put a process back to run queue of CPU [cpu] */
+void put_proc(int cpu, struct pcb_t * proc);
 
-/* Add a new process to ready queue */
+/* Add a new process to the least loaded ready queue */
 void add_proc(struct pcb_t * proc);
 
-#endif
+/* [proc] has just run for one time slot */
+void tick_proc(struct pcb_t * proc);
 
+#endif
 
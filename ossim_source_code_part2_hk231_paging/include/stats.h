@@ -0,0 +1,43 @@
+
+#ifndef STATS_H
+#define STATS_H
+
+#include "common.h"
+
+/*
+ * Scheduling metrics.
+ * With SCHED_STATS the scheduler records, for every process, its arrival
+ * slot, first dispatch, time spent waiting in a run queue and the number
+ * of dispatches, and every CPU counts the slots in which it ran a process.
+ * stats_dump writes one row per finished process followed by percentile
+ * summaries, as JSON if the path ends with .json and CSV otherwise.
+ * All slots are read from the timer, so the metrics cost nothing to the
+ * simulated time.
+ */
+
+#ifdef SCHED_STATS
+void stats_init(int num_cpus);
+/* [proc] is added to the scheduler */
+void stats_arrive(struct pcb_t * proc);
+/* [proc] leaves a run queue to run */
+void stats_dispatch(struct pcb_t * proc);
+/* [proc] is put back to a run queue */
+void stats_preempt(struct pcb_t * proc);
+/* [proc] has finished, called before it is freed */
+void stats_finish(struct pcb_t * proc);
+/* CPU [cpu] has run a process for one slot */
+void stats_busy(int cpu);
+/* Write the metrics to [path] and release them. Returns -1 on error */
+int stats_dump(const char * path);
+#else
+#define stats_init(num_cpus)	((void)0)
+#define stats_arrive(proc)	((void)0)
+#define stats_dispatch(proc)	((void)0)
+#define stats_preempt(proc)	((void)0)
+#define stats_finish(proc)	((void)0)
+#define stats_busy(cpu)		((void)0)
+#define stats_dump(path)	(0)
+#endif
+
+#endif
+
@@ -1,16 +1,16 @@
+
 #ifndef TIMER_H
 #define TIMER_H
 
 #include <pthread.h>
 #include <stdint.h>
 
+/* A device synchronised by the timer. Every slot all devices and the
+ * timer meet at a sense-reversing barrier, [sense] is the barrier sense
+ * this device waits for to leave the current slot */
 struct timer_id_t {
-	int done;
+	int sense;
 	int fsh;
-	pthread_cond_t event_cond;
-	pthread_mutex_t event_lock;
-	pthread_cond_t timer_cond;
-	pthread_mutex_t timer_lock;
 };
 
 void start_timer();
@@ -23,6 +23,19 @@ void detach_event(struct timer_id_t * event);
 
 void next_slot(struct timer_id_t* timer_id);
 
+/* Slot value meaning "no work scheduled at any known time" */
+#define TIMER_NEVER UINT64_MAX
+
+/* Like next_slot, but tell the timer this device has no work before slot
+ * [slot]. When every device is idle the timer jumps straight to the
+ * earliest slot one of them asked for instead of ticking through the
+ * slots in between */
+void next_slot_until(struct timer_id_t* timer_id, uint64_t slot);
+
 uint64_t current_time();
 
+/* Set the clock directly, for simulations which step all devices in one
+ * thread instead of starting the timer */
+void set_current_time(uint64_t time);
+
 #endif
@@ -0,0 +1,120 @@
+
+#define _GNU_SOURCE
+#include "affinity.h"
+#include <sched.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#define SYSFS_CPU "/sys/devices/system/cpu"
+
+struct host_cpu {
+	int cpu;	// Logical CPU number of the host
+	int package;	// physical_package_id
+	int core;	// core_id inside the package
+	int thread;	// Rank among the SMT siblings of its core
+};
+
+static struct host_cpu * hosts = NULL;
+static int nr_hosts = 0;
+static int aff_policy;
+
+/* Read an integer attribute of the topology of [cpu], -1 if missing */
+static int read_topology(int cpu, const char * attr) {
+	char path[128];
+	FILE * file;
+	int val = -1;
+
+	snprintf(path, sizeof(path), SYSFS_CPU "/cpu%d/topology/%s", cpu, attr);
+	if ((file = fopen(path, "r")) == NULL)
+		return -1;
+	if (fscanf(file, "%d", &val) != 1)
+		val = -1;
+	fclose(file);
+	return val;
+}
+
+static int cmp_spread(const void * a, const void * b) {
+	const struct host_cpu * x = a, * y = b;
+	if (x->thread != y->thread)
+		return x->thread - y->thread;
+	if (x->package != y->package)
+		return x->package - y->package;
+	if (x->core != y->core)
+		return x->core - y->core;
+	return x->cpu - y->cpu;
+}
+
+static int cmp_pack(const void * a, const void * b) {
+	const struct host_cpu * x = a, * y = b;
+	if (x->package != y->package)
+		return x->package - y->package;
+	if (x->core != y->core)
+		return x->core - y->core;
+	return x->cpu - y->cpu;
+}
+
+int affinity_init(int policy) {
+	cpu_set_t allowed;
+	int cpu, i, j;
+
+	CPU_ZERO(&allowed);
+	if (sched_getaffinity(0, sizeof(allowed), &allowed) != 0)
+		return 0;
+
+	aff_policy = policy;
+	hosts = malloc(sizeof(struct host_cpu) * CPU_COUNT(&allowed));
+	nr_hosts = 0;
+	for (cpu = 0; cpu < CPU_SETSIZE; cpu++) {
+		if (!CPU_ISSET(cpu, &allowed))
+			continue;
+		struct host_cpu * host = &hosts[nr_hosts++];
+		host->cpu = cpu;
+		host->package = read_topology(cpu, "physical_package_id");
+		host->core = read_topology(cpu, "core_id");
+		if (host->core < 0) /* No topology, every CPU is a core */
+			host->core = cpu;
+	}
+
+	/* Siblings are the CPUs sharing package and core, ranked by number */
+	for (i = 0; i < nr_hosts; i++) {
+		hosts[i].thread = 0;
+		for (j = 0; j < i; j++)
+			if (hosts[j].package == hosts[i].package
+					&& hosts[j].core == hosts[i].core)
+				hosts[i].thread++;
+	}
+
+	qsort(hosts, nr_hosts, sizeof(struct host_cpu),
+		(policy == AFFINITY_PACK) ? cmp_pack : cmp_spread);
+	return nr_hosts;
+}
+
+int affinity_pin(pthread_t thread, enum aff_role role, int id) {
+	static const char * names[] = { "timer", "loader", "cpu" };
+	cpu_set_t set;
+
+	if (nr_hosts == 0)
+		return -1;
+
+	int slot = (role == AFF_CPU) ? id + 1 : 0;
+	struct host_cpu * host = &hosts[slot % nr_hosts];
+
+	CPU_ZERO(&set);
+	CPU_SET(host->cpu, &set);
+	if (pthread_setaffinity_np(thread, sizeof(set), &set) != 0) {
+		fprintf(stderr, "affinity: cannot pin %s %d\n", names[role], id);
+		return -1;
+	}
+	fprintf(stderr, "affinity: %s %d -> host cpu %d "
+		"(package %d core %d thread %d, %s)\n",
+		names[role], id, host->cpu, host->package, host->core,
+		host->thread, (aff_policy == AFFINITY_PACK) ? "pack" : "spread");
+	return host->cpu;
+}
+
+void affinity_finish(void) {
+	free(hosts);
+	hosts = NULL;
+	nr_hosts = 0;
+}
+
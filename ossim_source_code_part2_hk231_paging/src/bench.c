@@ -0,0 +1,568 @@
+
+/*
+ * Scheduler benchmark
+ * Each thread plays a CPU that asks for a process, "runs" it for a slot
+ * and puts it back, without waiting on the timer. We report slots/sec for
+ * the single global run queue (init_scheduler(1)) against one run queue
+ * per CPU with work stealing (init_scheduler(N)).
+ * The dispatch benchmark then measures one get_proc/put_proc round trip
+ * with every process parked on a single priority level, which should cost
+ * the same whichever level it is and however deep the level queue is.
+ * The timer benchmark runs N devices through next_slot and reports the
+ * tick rate and the latency of a tick as seen by one device.
+ * The interpreter benchmark runs a CALC only program in slices of IPC
+ * instructions with run_slice().
+ * The operation benchmarks report ns/op as a mean and percentiles over
+ * samples. Cheap operations are timed in batches of BENCH_BATCH, so a
+ * sample is the mean of its batch.
+ * Usage: bench [max cpus]
+ */
+
+#include "cpu.h"
+#include "mm.h"
+#include "mm-tlb.h"
+#include "queue.h"
+#include "sched.h"
+#include "timer.h"
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#define BENCH_SLOTS	200000	/* Slots executed by every CPU thread */
+#define BENCH_PROCS_PER_CPU	2
+#define BENCH_DISPATCHES	2000000
+#define BENCH_DISPATCH_PROCS	8
+#define BENCH_DISPATCH_DEPTH	4096	/* Deepest level queue measured */
+#define BENCH_TICKS	20000
+#define BENCH_CODE_SIZE	(1 << 20)	/* Instructions of the CALC program */
+#define BENCH_SAMPLES	20000	/* Samples of an operation measure */
+#define BENCH_BATCH	64	/* Operations per sample of a cheap operation */
+#define BENCH_FRAMES	1024	/* Frames of MEMRAM and MEMSWP */
+
+struct bench_cpu_args {
+	int id;
+	pthread_barrier_t * start;
+	unsigned long slots;
+};
+
+static uint64_t now_ns(void) {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000UL + ts.tv_nsec;
+}
+
+static void * bench_cpu_routine(void * args) {
+	struct bench_cpu_args * cpu = (struct bench_cpu_args *)args;
+	unsigned long i;
+	pthread_barrier_wait(cpu->start);
+	for (i = 0; i < BENCH_SLOTS; i++) {
+		struct pcb_t * proc = get_proc(cpu->id);
+		if (proc != NULL) {
+			proc->pc++;
+			put_proc(cpu->id, proc);
+		}
+	}
+	cpu->slots = i;
+	return NULL;
+}
+
+static double bench_sched(int num_cpus, int num_rqs) {
+	int nprocs = num_cpus * BENCH_PROCS_PER_CPU;
+	struct pcb_t * procs = calloc(nprocs, sizeof(struct pcb_t));
+	pthread_t * cpu = malloc(num_cpus * sizeof(pthread_t));
+	struct bench_cpu_args * args = calloc(num_cpus, sizeof(*args));
+	pthread_barrier_t start;
+	unsigned long slots = 0;
+	int i;
+
+	init_scheduler(num_rqs, 1);
+	for (i = 0; i < nprocs; i++) {
+		procs[i].pid = i + 1;
+#ifdef MLQ_SCHED
+		procs[i].prio = i % MAX_PRIO;
+#endif
+		add_proc(&procs[i]);
+	}
+
+	pthread_barrier_init(&start, NULL, num_cpus + 1);
+	for (i = 0; i < num_cpus; i++) {
+		args[i].id = i;
+		args[i].start = &start;
+		pthread_create(&cpu[i], NULL, bench_cpu_routine, &args[i]);
+	}
+	pthread_barrier_wait(&start);
+	uint64_t t0 = now_ns();
+	for (i = 0; i < num_cpus; i++) {
+		pthread_join(cpu[i], NULL);
+		slots += args[i].slots;
+	}
+	uint64_t t1 = now_ns();
+
+	pthread_barrier_destroy(&start);
+	finish_scheduler();
+	free(args);
+	free(cpu);
+	free(procs);
+	return slots * 1e9 / (double)(t1 - t0);
+}
+
+#ifdef MLQ_SCHED
+static double bench_dispatch(int prio, int nprocs) {
+	struct pcb_t * procs = calloc(nprocs, sizeof(struct pcb_t));
+	unsigned long i;
+
+	init_scheduler(1, 1);
+	for (i = 0; i < nprocs; i++) {
+		procs[i].pid = i + 1;
+		procs[i].prio = prio;
+		add_proc(&procs[i]);
+	}
+
+	uint64_t t0 = now_ns();
+	for (i = 0; i < BENCH_DISPATCHES; i++)
+		put_proc(0, get_proc(0));
+	uint64_t t1 = now_ns();
+
+	finish_scheduler();
+	free(procs);
+	return (double)(t1 - t0) / BENCH_DISPATCHES;
+}
+#endif
+
+struct bench_dev_args {
+	struct timer_id_t * timer_id;
+	uint64_t * lat;	/* Per tick latency, only recorded by device 0 */
+};
+
+static void * bench_dev_routine(void * args) {
+	struct bench_dev_args * dev = (struct bench_dev_args *)args;
+	int i;
+	uint64_t t0 = now_ns();
+	for (i = 0; i < BENCH_TICKS; i++) {
+		next_slot(dev->timer_id);
+		if (dev->lat != NULL) {
+			uint64_t t1 = now_ns();
+			dev->lat[i] = t1 - t0;
+			t0 = t1;
+		}
+	}
+	detach_event(dev->timer_id);
+	return NULL;
+}
+
+static int cmp_double(const void * a, const void * b) {
+	double x = *(const double *)a, y = *(const double *)b;
+	return (x > y) - (x < y);
+}
+
+static void report_header(void) {
+	printf("\n%-32s %10s %10s %10s %10s %10s\n",
+		"op", "ns/op", "p50", "p90", "p99", "max");
+}
+
+/* Print the mean and percentiles of [n] samples of ns/op */
+static void report(const char * name, double * ns, int n) {
+	double sum = 0;
+	int i;
+	qsort(ns, n, sizeof(double), cmp_double);
+	for (i = 0; i < n; i++)
+		sum += ns[i];
+	printf("%-32s %10.1f %10.1f %10.1f %10.1f %10.1f\n", name, sum / n,
+		ns[n / 2], ns[n * 9 / 10], ns[n * 99 / 100], ns[n - 1]);
+}
+
+static void bench_timer(int ndevs) {
+	pthread_t * dev = malloc(ndevs * sizeof(pthread_t));
+	struct bench_dev_args * args = calloc(ndevs, sizeof(*args));
+	uint64_t * lat = malloc(BENCH_TICKS * sizeof(uint64_t));
+	double * ns = malloc(BENCH_TICKS * sizeof(double));
+	char name[64];
+	int i;
+
+	/* The timer prints every slot, keep it out of the report */
+	fflush(stdout);
+	int saved = dup(STDOUT_FILENO);
+	int devnull = open("/dev/null", O_WRONLY);
+	dup2(devnull, STDOUT_FILENO);
+
+	for (i = 0; i < ndevs; i++)
+		args[i].timer_id = attach_event();
+	args[0].lat = lat;
+	start_timer();
+	for (i = 0; i < ndevs; i++)
+		pthread_create(&dev[i], NULL, bench_dev_routine, &args[i]);
+	for (i = 0; i < ndevs; i++)
+		pthread_join(dev[i], NULL);
+	stop_timer();
+
+	fflush(stdout);
+	dup2(saved, STDOUT_FILENO);
+	close(saved);
+	close(devnull);
+
+	for (i = 0; i < BENCH_TICKS; i++)
+		ns[i] = lat[i];
+	snprintf(name, sizeof(name), "next_slot, %d devs", ndevs);
+	report(name, ns, BENCH_TICKS);
+
+	free(ns);
+	free(lat);
+	free(args);
+	free(dev);
+}
+
+static void bench_queue(int depth) {
+	struct pcb_t * procs = calloc(depth + BENCH_BATCH, sizeof(struct pcb_t));
+	double * enq = malloc(BENCH_SAMPLES * sizeof(double));
+	double * deq = malloc(BENCH_SAMPLES * sizeof(double));
+	struct queue_t q;
+	char name[64];
+	int i, j;
+
+	init_queue(&q);
+	for (i = 0; i < depth; i++)
+		enqueue(&q, &procs[i]);
+	for (i = 0; i < BENCH_SAMPLES; i++) {
+		uint64_t t0 = now_ns();
+		for (j = 0; j < BENCH_BATCH; j++)
+			enqueue(&q, &procs[depth + j]);
+		uint64_t t1 = now_ns();
+		for (j = 0; j < BENCH_BATCH; j++)
+			dequeue(&q);
+		uint64_t t2 = now_ns();
+		enq[i] = (double)(t1 - t0) / BENCH_BATCH;
+		deq[i] = (double)(t2 - t1) / BENCH_BATCH;
+	}
+	snprintf(name, sizeof(name), "enqueue, depth %d", depth);
+	report(name, enq, BENCH_SAMPLES);
+	snprintf(name, sizeof(name), "dequeue, depth %d", depth);
+	report(name, deq, BENCH_SAMPLES);
+
+	free_queue(&q);
+	free(deq);
+	free(enq);
+	free(procs);
+}
+
+struct bench_rq_args {
+	int id;
+	pthread_barrier_t * start;
+	double * ns;	/* BENCH_SAMPLES samples of a get_proc/put_proc pair */
+};
+
+static void * bench_rq_routine(void * args) {
+	struct bench_rq_args * cpu = (struct bench_rq_args *)args;
+	int i, j;
+	pthread_barrier_wait(cpu->start);
+	for (i = 0; i < BENCH_SAMPLES; i++) {
+		uint64_t t0 = now_ns();
+		for (j = 0; j < BENCH_BATCH; j++) {
+			struct pcb_t * proc = get_proc(cpu->id);
+			if (proc != NULL)
+				put_proc(cpu->id, proc);
+		}
+		cpu->ns[i] = (double)(now_ns() - t0) / BENCH_BATCH;
+	}
+	return NULL;
+}
+
+static void bench_rq(int num_cpus) {
+	int nprocs = num_cpus * BENCH_PROCS_PER_CPU;
+	struct pcb_t * procs = calloc(nprocs, sizeof(struct pcb_t));
+	pthread_t * cpu = malloc(num_cpus * sizeof(pthread_t));
+	struct bench_rq_args * args = calloc(num_cpus, sizeof(*args));
+	double * ns = malloc(num_cpus * BENCH_SAMPLES * sizeof(double));
+	pthread_barrier_t start;
+	char name[64];
+	int i;
+
+	init_scheduler(num_cpus, 1);
+	for (i = 0; i < nprocs; i++) {
+		procs[i].pid = i + 1;
+#ifdef MLQ_SCHED
+		procs[i].prio = i % MAX_PRIO;
+#endif
+		add_proc(&procs[i]);
+	}
+
+	pthread_barrier_init(&start, NULL, num_cpus);
+	for (i = 0; i < num_cpus; i++) {
+		args[i].id = i;
+		args[i].start = &start;
+		args[i].ns = &ns[i * BENCH_SAMPLES];
+		pthread_create(&cpu[i], NULL, bench_rq_routine, &args[i]);
+	}
+	for (i = 0; i < num_cpus; i++)
+		pthread_join(cpu[i], NULL);
+	snprintf(name, sizeof(name), "get_proc+put_proc, %d threads",
+		num_cpus);
+	report(name, ns, num_cpus * BENCH_SAMPLES);
+
+	pthread_barrier_destroy(&start);
+	finish_scheduler();
+	free(ns);
+	free(args);
+	free(cpu);
+	free(procs);
+}
+
+#ifdef MM_PAGING
+/* A process with an empty mm on a RAM and a swap of BENCH_FRAMES frames */
+struct bench_mm {
+	struct pcb_t proc;
+	struct mm_struct mm;
+	struct memphy_struct ram;
+	struct memphy_struct swp[PAGING_MAX_MMSWP];
+};
+
+static void bench_mm_init(struct bench_mm * b) {
+	int i;
+	memset(b, 0, sizeof(*b));
+	init_memphy(&b->ram, BENCH_FRAMES * PAGING_PAGESZ, 1);
+	init_memphy(&b->swp[0], BENCH_FRAMES * PAGING_PAGESZ, 1);
+	for (i = 1; i < PAGING_MAX_MMSWP; i++)
+		init_memphy(&b->swp[i], 0, 1);
+	b->proc.pid = 1;
+	b->proc.mm = &b->mm;
+	b->proc.mram = &b->ram;
+	b->proc.mswp = (struct memphy_struct **)b->swp;
+	b->proc.active_mswp = &b->swp[0];
+	init_mm(&b->mm, &b->proc);
+}
+
+static void bench_mm_finish(struct bench_mm * b) {
+	int i;
+	free_mm(&b->mm, &b->proc);
+	free_memphy(&b->ram);
+	for (i = 0; i < PAGING_MAX_MMSWP; i++)
+		free_memphy(&b->swp[i]);
+}
+
+static void bench_freefp(void) {
+	struct bench_mm b;
+	double * get = malloc(BENCH_SAMPLES * sizeof(double));
+	double * put = malloc(BENCH_SAMPLES * sizeof(double));
+	int fpn[BENCH_BATCH];
+	int i, j;
+
+	bench_mm_init(&b);
+	for (i = 0; i < BENCH_SAMPLES; i++) {
+		uint64_t t0 = now_ns();
+		for (j = 0; j < BENCH_BATCH; j++)
+			MEMPHY_get_freefp(&b.ram, &fpn[j]);
+		uint64_t t1 = now_ns();
+		for (j = 0; j < BENCH_BATCH; j++)
+			MEMPHY_put_freefp(&b.ram, fpn[j]);
+		uint64_t t2 = now_ns();
+		get[i] = (double)(t1 - t0) / BENCH_BATCH;
+		put[i] = (double)(t2 - t1) / BENCH_BATCH;
+	}
+	report("MEMPHY_get_freefp", get, BENCH_SAMPLES);
+	report("MEMPHY_put_freefp", put, BENCH_SAMPLES);
+
+	/* The frames of a BENCH_BATCH pages ALLOC, claimed at once */
+	for (i = 0; i < BENCH_SAMPLES; i++) {
+		uint64_t t0 = now_ns();
+		alloc_pages_range(&b.proc, BENCH_BATCH, fpn);
+		uint64_t t1 = now_ns();
+		MEMPHY_put_freefp_range(&b.ram, BENCH_BATCH, fpn);
+		get[i] = (double)(t1 - t0);
+	}
+	report("alloc_pages_range, 64 frames", get, BENCH_SAMPLES);
+
+	/* Startup of a 1GB device, its storage left out */
+	for (i = 0; i < BENCH_SAMPLES / 100; i++) {
+		struct memphy_struct mp = { .maxsz = 1 << 30 };
+		uint64_t t0 = now_ns();
+		MEMPHY_format(&mp, PAGING_PAGESZ);
+		uint64_t t1 = now_ns();
+		free_memphy(&mp);
+		get[i] = (double)(t1 - t0);
+	}
+	report("MEMPHY_format, 1GB", get, BENCH_SAMPLES / 100);
+
+	bench_mm_finish(&b);
+	free(put);
+	free(get);
+}
+
+static void bench_getval(void) {
+	struct bench_mm b;
+	double * ns = malloc(BENCH_SAMPLES * sizeof(double));
+	int i, j, fpn, swpfpn;
+	BYTE data;
+
+	bench_mm_init(&b);
+
+	/* Hit: page 0 is in RAM */
+	MEMPHY_get_freefp(&b.ram, &fpn);
+	uint32_t * pte = pte_alloc(&b.mm, 0);
+	pte_set_fpn(pte, fpn);
+	for (i = 0; i < BENCH_SAMPLES; i++) {
+		uint64_t t0 = now_ns();
+		for (j = 0; j < BENCH_BATCH; j++)
+			pg_getval(&b.mm, j % PAGING_PAGESZ, &data, &b.proc);
+		ns[i] = (double)(now_ns() - t0) / BENCH_BATCH;
+	}
+	report("pg_getval, hit", ns, BENCH_SAMPLES);
+#ifdef MM_TLB
+	tlb_init(1);
+	tlb_set_cpu(0);
+	for (i = 0; i < BENCH_SAMPLES; i++) {
+		uint64_t t0 = now_ns();
+		for (j = 0; j < BENCH_BATCH; j++)
+			pg_getval(&b.mm, j % PAGING_PAGESZ, &data, &b.proc);
+		ns[i] = (double)(now_ns() - t0) / BENCH_BATCH;
+	}
+	report("pg_getval, hit, tlb", ns, BENCH_SAMPLES);
+#endif
+
+	/* Fault: page 0 is swapped out again before every access, RAM
+	 * has a free frame to bring it back to */
+	for (i = 0; i < BENCH_SAMPLES; i++) {
+		fpn = GETVAL(*pte, PAGING_PTE_FPN_MASK, PAGING_PTE_FPN_LOBIT);
+		MEMPHY_get_freefp(&b.swp[0], &swpfpn);
+		__swap_cp_page(&b.ram, fpn, &b.swp[0], swpfpn);
+		MEMPHY_put_freefp(&b.ram, fpn);
+		pte_set_swap(pte, 0, swpfpn);
+		tlb_invalidate(b.proc.pid, 0);
+
+		uint64_t t0 = now_ns();
+		pg_getval(&b.mm, i % PAGING_PAGESZ, &data, &b.proc);
+		ns[i] = (double)(now_ns() - t0);
+	}
+	report("pg_getval, swap fault", ns, BENCH_SAMPLES);
+#ifdef MM_TLB
+	tlb_finish();
+#endif
+
+	bench_mm_finish(&b);
+	free(ns);
+}
+
+static void bench_swap_cp(void) {
+	struct bench_mm b;
+	double * ns = malloc(BENCH_SAMPLES * sizeof(double));
+	int i, j;
+
+	bench_mm_init(&b);
+	for (i = 0; i < BENCH_SAMPLES; i++) {
+		uint64_t t0 = now_ns();
+		for (j = 0; j < BENCH_BATCH; j++)
+			__swap_cp_page(&b.ram, j, &b.swp[0], BENCH_FRAMES - 1 - j);
+		ns[i] = (double)(now_ns() - t0) / BENCH_BATCH;
+	}
+	report("__swap_cp_page", ns, BENCH_SAMPLES);
+
+	bench_mm_finish(&b);
+	free(ns);
+}
+
+/* Allocations fit only the last of [nfrags] free regions, every other one
+ * is a hole too small for them */
+static void bench_vmrg(int nfrags) {
+	struct bench_mm b;
+	double * ns = malloc(BENCH_SAMPLES * sizeof(double));
+	struct vm_rg_struct rg;
+	char name[64];
+	unsigned long base = 1UL << 30;
+	int i, j;
+
+	bench_mm_init(&b);
+	struct vm_area_struct * vma = b.mm.mmap;
+	enlist_vm_rg_node(&vma->vm_freerg_list, init_vm_rg(base, 2 * base));
+	for (i = nfrags - 1; i > 0; i--)
+		enlist_vm_rg_node(&vma->vm_freerg_list,
+			init_vm_rg(i * 64, i * 64 + 16));
+	for (i = 0; i < BENCH_SAMPLES; i++) {
+		uint64_t t0 = now_ns();
+		for (j = 0; j < BENCH_BATCH; j++)
+			get_free_vmrg_area(&b.proc, 0, 32, &rg);
+		ns[i] = (double)(now_ns() - t0) / BENCH_BATCH;
+	}
+	snprintf(name, sizeof(name), "get_free_vmrg_area, %d regions",
+		nfrags);
+	report(name, ns, BENCH_SAMPLES);
+
+	bench_mm_finish(&b);
+	free(ns);
+}
+#endif
+
+/* ns per instruction, in slices of [ipc] */
+static double bench_interp(int ipc) {
+	struct code_seg_t code;
+	struct pcb_t proc;
+	uint32_t i;
+
+	code.size = BENCH_CODE_SIZE;
+	code.text = calloc(code.size, sizeof(struct inst_t));
+	code.decoded = NULL;
+	for (i = 0; i < code.size; i++)
+		code.text[i].opcode = CALC;
+	memset(&proc, 0, sizeof(proc));
+	proc.code = &code;
+	run_slice(&proc, 0); /* Decode outside of the measure */
+
+	uint64_t t0 = now_ns();
+	while (proc.pc < code.size)
+		run_slice(&proc, ipc);
+	uint64_t t1 = now_ns();
+
+	free(code.decoded);
+	free(code.text);
+	return (double)(t1 - t0) / code.size;
+}
+
+int main(int argc, char * argv[]) {
+	int max_cpus = (argc > 1) ? atoi(argv[1]) : 16;
+	int n;
+
+	printf("%-6s %16s %16s %8s\n",
+		"cpus", "global slots/s", "per-cpu slots/s", "speedup");
+	for (n = 1; n <= max_cpus; n *= 2) {
+		double global = bench_sched(n, 1);
+		double percpu = bench_sched(n, n);
+		printf("%-6d %16.0f %16.0f %7.2fx\n",
+			n, global, percpu, percpu / global);
+	}
+
+#ifdef MLQ_SCHED
+	int prio;
+	printf("\n%-6s %16s\n", "prio", "ns/dispatch");
+	for (prio = 0; prio < MAX_PRIO; prio += MAX_PRIO / 4)
+		printf("%-6d %16.1f\n", prio,
+			bench_dispatch(prio, BENCH_DISPATCH_PROCS));
+	printf("%-6d %16.1f\n", MAX_PRIO - 1,
+		bench_dispatch(MAX_PRIO - 1, BENCH_DISPATCH_PROCS));
+
+	printf("\n%-6s %16s\n", "depth", "ns/dispatch");
+	for (n = 1; n <= BENCH_DISPATCH_DEPTH; n *= 8)
+		printf("%-6d %16.1f\n", n, bench_dispatch(0, n));
+#endif
+
+	printf("\n%-6s %16s\n", "ipc", "ns/instruction");
+	for (n = 1; n <= 1024; n *= 32)
+		printf("%-6d %16.2f\n", n, bench_interp(n));
+
+	report_header();
+	for (n = 1; n <= BENCH_DISPATCH_DEPTH; n *= 64)
+		bench_queue(n);
+	for (n = 1; n <= max_cpus; n *= 2)
+		bench_rq(n);
+	for (n = 1; n <= max_cpus; n *= 2)
+		bench_timer(n);
+#ifdef MM_PAGING
+	bench_freefp();
+	bench_getval();
+	bench_swap_cp();
+	for (n = 1; n <= BENCH_DISPATCH_DEPTH; n *= 64)
+		bench_vmrg(n);
+#endif
+	return 0;
+}
+
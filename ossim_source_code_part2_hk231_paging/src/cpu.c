@@ -2,6 +2,7 @@
 #include "cpu.h"
 #include "mem.h"
 #include "mm.h"
+#include <stdlib.h>
 
 int calc(struct pcb_t * proc) {
 	return ((unsigned long)proc & 0UL);
@@ -45,51 +46,188 @@ int write(
 	return write_mem(proc->regs[destination] + offset, proc, data);
 }
 
-int run(struct pcb_t * proc) {
-	/* Check if Program Counter point to the proper instruction */
-	if (proc->pc >= proc->code->size) {
-		return 1;
+/* Translate the code of a process into handler addresses of run_slice.
+ * The code may be shared with processes running on other CPUs, the first
+ * CPU to publish its translation wins */
+static void decode(struct code_seg_t * code, const void * const * ops) {
+	uint32_t i, calc_run = 0;
+	struct dinst_t * decoded = malloc(sizeof(struct dinst_t) * code->size);
+	struct dinst_t * expected = NULL;
+
+	/* Walk backward so every CALC knows how many follow it */
+	for (i = code->size; i-- > 0; ) {
+		struct inst_t * ins = &code->text[i];
+		struct dinst_t * d = &decoded[i];
+		d->op = ops[ins->opcode];
+		d->arg_0 = ins->arg_0;
+		d->arg_1 = ins->arg_1;
+		d->arg_2 = ins->arg_2;
+		d->arg_3 = ins->arg_3;
+		d->arg_4 = ins->arg_4;
+		if (ins->opcode == CALC)
+			d->arg_0 = ++calc_run;
+		else
+			calc_run = 0;
 	}
+	if (!__atomic_compare_exchange_n(&code->decoded, &expected, decoded,
+			0, __ATOMIC_RELEASE, __ATOMIC_ACQUIRE))
+		free(decoded);
+}
 
-	struct inst_t ins = proc->code->text[proc->pc];
-	proc->pc++;
-	int stat = 1;
-	switch (ins.opcode) {
-	case CALC:
-		stat = calc(proc);
-		break;
-	case ALLOC:
-#ifdef MM_PAGING
-		stat = pgalloc(proc, ins.arg_0, ins.arg_1);
+/*
+ * Direct threaded interpreter: every handler jumps straight to the handler
+ * of the next instruction. A run of CALC only moves the program counter,
+ * so it is consumed in one step, as far as the budget allows.
+ */
+int run_slice(struct pcb_t * proc, int budget) {
+	static const void * const ops[] = {
+		[CALC] = &&op_calc,
+		[ALLOC] = &&op_alloc,
+		[FREE] = &&op_free,
+		[READ] = &&op_read,
+		[WRITE] = &&op_write,
+		[COPY] = &&op_copy,
+		[FILL] = &&op_fill,
+		[COMPARE] = &&op_compare,
+	};
+	struct code_seg_t * code = proc->code;
+	struct dinst_t * ins;
+	int done = 0;
 
+	if (__atomic_load_n(&code->decoded, __ATOMIC_ACQUIRE) == NULL)
+		decode(code, ops);
+
+#define DISPATCH() do { \
+		if (done >= budget || proc->pc >= code->size) \
+			return done; \
+		ins = &code->decoded[proc->pc]; \
+		goto *ins->op; \
+	} while (0)
+
+#define NEXT() do { \
+		proc->pc++; \
+		done++; \
+		DISPATCH(); \
+	} while (0)
+
+	DISPATCH();
+
+op_calc: {
+		uint32_t n = ins->arg_0;
+		if (n > (uint32_t)(budget - done))
+			n = budget - done;
+		proc->pc += n;
+		done += n;
+		DISPATCH();
+	}
+op_alloc:
+#ifdef MM_PAGING
+	pgalloc(proc, ins->arg_0, ins->arg_1);
+#else
+	alloc(proc, ins->arg_0, ins->arg_1);
+#endif
+	NEXT();
+op_free:
+#ifdef MM_PAGING
+	pgfree_data(proc, ins->arg_0);
+#else
+	free_data(proc, ins->arg_0);
+#endif
+	NEXT();
+op_read:
+#ifdef MM_PAGING
+	pgread(proc, ins->arg_0, ins->arg_1, ins->arg_2);
+#else
+	read(proc, ins->arg_0, ins->arg_1, ins->arg_2);
+#endif
+	NEXT();
+op_write:
+#ifdef MM_PAGING
+	pgwrite(proc, ins->arg_0, ins->arg_1, ins->arg_2);
 #else
-		stat = alloc(proc, ins.arg_0, ins.arg_1);
+	write(proc, ins->arg_0, ins->arg_1, ins->arg_2);
 #endif
-		break;
-	case FREE:
+	NEXT();
+op_copy:
 #ifdef MM_PAGING
-		stat = pgfree_data(proc, ins.arg_0);
+	pgcopy(proc, ins->arg_0, ins->arg_1, ins->arg_2, ins->arg_3, ins->arg_4);
 #else
-		stat = free_data(proc, ins.arg_0);
+	copy(proc, ins->arg_0, ins->arg_1, ins->arg_2, ins->arg_3, ins->arg_4);
 #endif
-		break;
-	case READ:
+	NEXT();
+op_fill:
 #ifdef MM_PAGING
-		stat = pgread(proc, ins.arg_0, ins.arg_1, ins.arg_2);
+	pgfill(proc, ins->arg_0, ins->arg_1, ins->arg_2, ins->arg_3);
 #else
-		stat = read(proc, ins.arg_0, ins.arg_1, ins.arg_2);
+	fill(proc, ins->arg_0, ins->arg_1, ins->arg_2, ins->arg_3);
 #endif
-		break;
-	case WRITE:
+	NEXT();
+op_compare:
 #ifdef MM_PAGING
-		stat = pgwrite(proc, ins.arg_0, ins.arg_1, ins.arg_2);
+	pgcompare(proc, ins->arg_0, ins->arg_1, ins->arg_2, ins->arg_3, ins->arg_4);
 #else
-		stat = write(proc, ins.arg_0, ins.arg_1, ins.arg_2);
+	compare(proc, ins->arg_0, ins->arg_1, ins->arg_2, ins->arg_3, ins->arg_4);
 #endif
-		break;
-	default:
-		stat = 1;
+	NEXT();
+
+#undef NEXT
+#undef DISPATCH
+}
+
+int copy(
+		struct pcb_t * proc, // Process executing the instruction
+		uint32_t source, // Index of source register
+		uint32_t srcoff, // Source address = [source] + [srcoff]
+		uint32_t destination, // Index of destination register
+		uint32_t dstoff, // Destination address = [destination] + [dstoff]
+		uint32_t size) {
+	BYTE data;
+	uint32_t i;
+	for (i = 0; i < size; i++) {
+		if (read_mem(proc->regs[source] + srcoff + i, proc, &data)
+				|| write_mem(proc->regs[destination] + dstoff + i,
+					proc, data))
+			return 1;
 	}
-	return stat;
+	return 0;
+}
 
+int fill(
+		struct pcb_t * proc, // Process executing the instruction
+		uint32_t destination, // Index of destination register
+		uint32_t offset, // Destination address = [destination] + [offset]
+		uint32_t size,
+		BYTE data) {
+	uint32_t i;
+	for (i = 0; i < size; i++) {
+		if (write_mem(proc->regs[destination] + offset + i, proc, data))
+			return 1;
+	}
+	return 0;
+}
+
+int compare(
+		struct pcb_t * proc, // Process executing the instruction
+		uint32_t first, // Index of the first register
+		uint32_t firstoff, // First address = [first] + [firstoff]
+		uint32_t second, // Index of the second register
+		uint32_t secondoff, // Second address = [second] + [secondoff]
+		uint32_t size) {
+	BYTE a, b;
+	uint32_t i;
+	for (i = 0; i < size; i++) {
+		if (read_mem(proc->regs[first] + firstoff + i, proc, &a)
+				|| read_mem(proc->regs[second] + secondoff + i,
+					proc, &b))
+			return 1;
+		if (a != b)
+			break;
+	}
+	return 0;
 }
+
+int run(struct pcb_t * proc) {
+	/* One instruction of the interpreter of run_slice */
+	return (run_slice(proc, 1) == 1) ? 0 : 1;
+}
+
@@ -1,8 +1,14 @@
 
 #include "loader.h"
+#include "mm.h"
+#include <pthread.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
 
 static uint32_t avail_pid = 1;
 
@@ -11,6 +17,9 @@ static uint32_t avail_pid = 1;
 #define OPT_FREE	"free"
 #define OPT_READ	"read"
 #define OPT_WRITE	"write"
+#define OPT_COPY	"copy"
+#define OPT_FILL	"fill"
+#define OPT_COMPARE	"compare"
 
 static enum ins_opcode_t get_opcode(char * opt) {
 	if (!strcmp(opt, OPT_CALC)) {
@@ -23,60 +32,214 @@ static enum ins_opcode_t get_opcode(char * opt) {
 		return READ;
 	}else if (!strcmp(opt, OPT_WRITE)) {
 		return WRITE;
+	}else if (!strcmp(opt, OPT_COPY)) {
+		return COPY;
+	}else if (!strcmp(opt, OPT_FILL)) {
+		return FILL;
+	}else if (!strcmp(opt, OPT_COMPARE)) {
+		return COMPARE;
 	}else{
 		printf("Opcode: %s\n", opt);
 		exit(1);
 	}
 }
 
-struct pcb_t * load(const char * path) {
-	/* Create new PCB for the new process */
-	struct pcb_t * proc = (struct pcb_t * )malloc(sizeof(struct pcb_t));
-	proc->pid = avail_pid;
-	avail_pid++;
-	proc->page_table =
-		(struct page_table_t*)malloc(sizeof(struct page_table_t));
-	proc->bp = PAGE_SIZE;
-	proc->pc = 0;
+/*
+ * Code segments are shared by every process running the same program.
+ * They are found by path first, as long as the file has not changed since
+ * it was loaded, then by the content of the file so the same program
+ * under different paths is loaded once too. Every path a program was
+ * found under is kept. The code_seg_t heads its cache entry, put_code
+ * finds the entry back from it.
+ */
+#define CODE_CACHE_BUCKETS	256
 
-	/* Read process code from file */
-	FILE * file;
-	if ((file = fopen(path, "r")) == NULL) {
-		printf("Cannot find process description at '%s'\n", path);
+struct code_ent;
+
+/* A path the program of [ent] was loaded from */
+struct code_path {
+	char * path;
+	dev_t dev;	// Identity of the file at [path] when it was loaded
+	ino_t ino;
+	size_t len;
+	struct timespec mtime;
+	struct code_ent * ent;
+	struct code_path * next;	// Next in path_cache
+	struct code_path * alias;	// Next path of [ent]
+};
+
+struct code_ent {
+	struct code_seg_t code;
+	uint64_t hash;	// FNV-1a of the program file
+	char * buf;	// The program file, mapped
+	size_t len;	// Length of the program file
+	uint32_t priority;
+	int refcnt;	// Processes using [code]
+	struct code_path * paths;
+	struct code_ent * next;	// Next in code_cache
+};
+
+static struct code_ent * code_cache[CODE_CACHE_BUCKETS];	// By content
+static struct code_path * path_cache[CODE_CACHE_BUCKETS];	// By path
+static pthread_mutex_t code_lock = PTHREAD_MUTEX_INITIALIZER;
+
+/* FNV-1a, over 8 bytes at a time */
+static uint64_t hash_file(const char * buf, size_t len) {
+	uint64_t hash = 0xcbf29ce484222325UL, word;
+	size_t i;
+	for (i = 0; i + 8 <= len; i += 8) {
+		memcpy(&word, buf + i, 8);
+		hash = (hash ^ word) * 0x100000001b3UL;
+	}
+	for (; i < len; i++)
+		hash = (hash ^ (unsigned char)buf[i]) * 0x100000001b3UL;
+	return hash;
+}
+
+static uint64_t hash_path(const char * path) {
+	return hash_file(path, strlen(path));
+}
+
+static int same_file(struct code_path * cp, const char * path,
+		struct stat * st) {
+	return strcmp(cp->path, path) == 0 && cp->dev == st->st_dev
+		&& cp->ino == st->st_ino && cp->len == (size_t)st->st_size
+		&& cp->mtime.tv_sec == st->st_mtim.tv_sec
+		&& cp->mtime.tv_nsec == st->st_mtim.tv_nsec;
+}
+
+/* Remember that [path] holds the program of [ent]. The caller holds
+ * code_lock */
+static void add_path(struct code_ent * ent, const char * path,
+		struct stat * st) {
+	struct code_path ** bucket =
+		&path_cache[hash_path(path) % CODE_CACHE_BUCKETS];
+	struct code_path * cp = malloc(sizeof(struct code_path));
+
+	cp->path = strdup(path);
+	cp->dev = st->st_dev;
+	cp->ino = st->st_ino;
+	cp->len = st->st_size;
+	cp->mtime = st->st_mtim;
+	cp->ent = ent;
+	cp->next = *bucket;
+	*bucket = cp;
+	cp->alias = ent->paths;
+	ent->paths = cp;
+}
+
+#define NR_REGS	10	// Registers of a process, see pcb_t
+
+/* Whether the opcode of [ins] is known and its register arguments are
+ * registers. An image is used as is, nothing else checks them */
+static int valid_inst(const struct inst_t * ins) {
+	switch (ins->opcode) {
+	case CALC:
+		return 1;
+	case ALLOC:
+		return ins->arg_1 < NR_REGS;
+	case FREE:
+	case FILL:
+		return ins->arg_0 < NR_REGS;
+	case READ:
+		return ins->arg_0 < NR_REGS && ins->arg_2 < NR_REGS;
+	case WRITE:
+		return ins->arg_1 < NR_REGS;
+	case COPY:
+	case COMPARE:
+		return ins->arg_0 < NR_REGS && ins->arg_2 < NR_REGS;
+	default:
+		return 0;
+	}
+}
+
+/* Use the image mapped at [buf] as code. Returns -1 if it is not an image */
+static int load_image(struct code_ent * ent, char * buf, const char * path) {
+	struct proc_image_hdr hdr;
+
+	if (ent->len < sizeof(hdr))
+		return -1;
+	memcpy(&hdr, buf, sizeof(hdr));
+	if (hdr.magic != PROC_IMAGE_MAGIC)
+		return -1;
+	if (hdr.version != PROC_IMAGE_VERSION || ent->len < sizeof(hdr)
+			+ (size_t)hdr.size * sizeof(struct inst_t)) {
+		printf("Bad process image '%s'\n", path);
 		exit(1);
 	}
+	struct inst_t * text = (struct inst_t *)(buf + sizeof(hdr));
+	uint32_t i;
+	for (i = 0; i < hdr.size; i++)
+		if (!valid_inst(&text[i])) {
+			printf("Bad process image '%s'\n", path);
+			exit(1);
+		}
+	ent->priority = hdr.priority;
+	ent->code.size = hdr.size;
+	ent->code.text = text;
+	ent->code.image = buf;
+	ent->code.image_len = ent->len;
+	return 0;
+}
+
+/* Parse the text program at [buf] */
+static void load_text(struct code_ent * ent, char * buf) {
+	struct code_seg_t * code = &ent->code;
 	char opcode[10];
-	proc->code = (struct code_seg_t*)malloc(sizeof(struct code_seg_t));
-	fscanf(file, "%u %u", &proc->priority, &proc->code->size);
-	proc->code->text = (struct inst_t*)malloc(
-		sizeof(struct inst_t) * proc->code->size
+
+	FILE * file = fmemopen(buf, ent->len, "r");
+	fscanf(file, "%u %u", &ent->priority, &code->size);
+	code->text = (struct inst_t*)calloc(
+		code->size, sizeof(struct inst_t)
 	);
 	uint32_t i = 0;
-	for (i = 0; i < proc->code->size; i++) {
+	for (i = 0; i < code->size; i++) {
 		fscanf(file, "%s", opcode);
-		proc->code->text[i].opcode = get_opcode(opcode);
-		switch(proc->code->text[i].opcode) {
+		code->text[i].opcode = get_opcode(opcode);
+		switch(code->text[i].opcode) {
 		case CALC:
 			break;
 		case ALLOC:
 			fscanf(
 				file,
 				"%u %u\n",
-				&proc->code->text[i].arg_0,
-				&proc->code->text[i].arg_1
+				&code->text[i].arg_0,
+				&code->text[i].arg_1
 			);
 			break;
 		case FREE:
-			fscanf(file, "%u\n", &proc->code->text[i].arg_0);
+			fscanf(file, "%u\n", &code->text[i].arg_0);
 			break;
 		case READ:
 		case WRITE:
 			fscanf(
 				file,
 				"%u %u %u\n",
-				&proc->code->text[i].arg_0,
-				&proc->code->text[i].arg_1,
-				&proc->code->text[i].arg_2
+				&code->text[i].arg_0,
+				&code->text[i].arg_1,
+				&code->text[i].arg_2
+			);
+			break;
+		case FILL:
+			fscanf(
+				file,
+				"%u %u %u %u\n",
+				&code->text[i].arg_0,
+				&code->text[i].arg_1,
+				&code->text[i].arg_2,
+				&code->text[i].arg_3
+			);
+			break;
+		case COPY:
+		case COMPARE:
+			fscanf(
+				file,
+				"%u %u %u %u %u\n",
+				&code->text[i].arg_0,
+				&code->text[i].arg_1,
+				&code->text[i].arg_2,
+				&code->text[i].arg_3,
+				&code->text[i].arg_4
 			);
 			break;
 		default:
@@ -84,5 +247,190 @@ struct pcb_t * load(const char * path) {
 			exit(1);
 		}
 	}
+	fclose(file);
+}
+
+/* Return the shared code of the program at [path], with one more user */
+static struct code_ent * get_code(const char * path) {
+	struct code_ent * ent;
+	struct stat st;
+	int fd;
+
+	if ((fd = open(path, O_RDONLY)) < 0 || fstat(fd, &st) != 0) {
+		printf("Cannot find process description at '%s'\n", path);
+		exit(1);
+	}
+
+	struct code_path * cp;
+	pthread_mutex_lock(&code_lock);
+	for (cp = path_cache[hash_path(path) % CODE_CACHE_BUCKETS];
+			cp != NULL; cp = cp->next) {
+		if (same_file(cp, path, &st)) {
+			ent = cp->ent;
+			ent->refcnt++;
+			pthread_mutex_unlock(&code_lock);
+			close(fd);
+			return ent;
+		}
+	}
+	pthread_mutex_unlock(&code_lock);
+
+	char * buf = (st.st_size > 0) ? mmap(NULL, st.st_size, PROT_READ,
+		MAP_PRIVATE, fd, 0) : MAP_FAILED;
+	close(fd);
+	if (buf == MAP_FAILED) {
+		printf("Cannot read process description at '%s'\n", path);
+		exit(1);
+	}
+
+	uint64_t hash = hash_file(buf, st.st_size);
+	struct code_ent ** bucket = &code_cache[hash % CODE_CACHE_BUCKETS];
+	pthread_mutex_lock(&code_lock);
+	for (ent = *bucket; ent != NULL; ent = ent->next) {
+		/* A hash may collide, only the same bytes make the same program */
+		if (ent->hash == hash && ent->len == (size_t)st.st_size
+				&& memcmp(ent->buf, buf, st.st_size) == 0) {
+			ent->refcnt++;
+			add_path(ent, path, &st);
+			pthread_mutex_unlock(&code_lock);
+			munmap(buf, st.st_size);
+			return ent;
+		}
+	}
+
+	ent = calloc(1, sizeof(struct code_ent));
+	ent->hash = hash;
+	ent->buf = buf;
+	ent->len = st.st_size;
+	ent->refcnt = 1;
+	if (load_image(ent, buf, path) != 0)
+		load_text(ent, buf);
+	ent->next = *bucket;
+	*bucket = ent;
+	add_path(ent, path, &st);
+	pthread_mutex_unlock(&code_lock);
+	return ent;
+}
+
+void hold_code(struct code_seg_t * code) {
+	struct code_ent * ent = (struct code_ent *)code;
+	pthread_mutex_lock(&code_lock);
+	ent->refcnt++;
+	pthread_mutex_unlock(&code_lock);
+}
+
+void put_code(struct code_seg_t * code) {
+	struct code_ent * ent = (struct code_ent *)code;
+	struct code_ent ** link;
+	struct code_path ** plink, * cp;
+
+	pthread_mutex_lock(&code_lock);
+	if (--ent->refcnt > 0) {
+		pthread_mutex_unlock(&code_lock);
+		return;
+	}
+	link = &code_cache[ent->hash % CODE_CACHE_BUCKETS];
+	while (*link != ent)
+		link = &(*link)->next;
+	*link = ent->next;
+	while ((cp = ent->paths) != NULL) {
+		ent->paths = cp->alias;
+		plink = &path_cache[hash_path(cp->path) % CODE_CACHE_BUCKETS];
+		while (*plink != cp)
+			plink = &(*plink)->next;
+		*plink = cp->next;
+		free(cp->path);
+		free(cp);
+	}
+	pthread_mutex_unlock(&code_lock);
+
+	/* An image is the mapping itself, text was parsed out of it */
+	if (code->image == NULL)
+		free(code->text);
+	munmap(ent->buf, ent->len);
+	free(code->decoded);
+	free(ent);
+}
+
+struct code_seg_t * load_code(const char * path) {
+	return &get_code(path)->code;
+}
+
+/*
+ * A process and the objects it owns, allocated together. Finished
+ * processes return their slot to a free list and later arrivals reuse it,
+ * so long runs do not keep allocating.
+ */
+struct proc_slot {
+	struct pcb_t pcb;	// First, free_proc finds the slot back from it
+	struct page_table_t page_table;
+#ifdef MM_PAGING
+	struct mm_struct mm;
+#endif
+	struct proc_slot * next;	// Next free slot
+};
+
+static struct proc_slot * free_slots = NULL;
+static pthread_mutex_t slot_lock = PTHREAD_MUTEX_INITIALIZER;
+
+struct pcb_t * load_proc(struct code_seg_t * code) {
+	/* Create new PCB for the new process, reusing a finished one */
+	pthread_mutex_lock(&slot_lock);
+	struct proc_slot * slot = free_slots;
+	if (slot != NULL)
+		free_slots = slot->next;
+	pthread_mutex_unlock(&slot_lock);
+	if (slot == NULL)
+		slot = malloc(sizeof(struct proc_slot));
+	memset(slot, 0, sizeof(struct proc_slot));
+
+	struct pcb_t * proc = &slot->pcb;
+	proc->pid = avail_pid;
+	avail_pid++;
+	proc->page_table = &slot->page_table;
+#ifdef MM_PAGING
+	proc->mm = &slot->mm;	// Empty until init_mm
+#endif
+	proc->bp = PAGE_SIZE;
+	proc->pc = 0;
+	proc->code = code;
+	proc->priority = ((struct code_ent *)code)->priority;
 	return proc;
 }
+
+void free_proc(struct pcb_t * proc) {
+	struct proc_slot * slot = (struct proc_slot *)proc;
+#ifdef MM_PAGING
+	free_mm(proc->mm, proc);
+#endif
+	put_code(proc->code);
+	pthread_mutex_lock(&slot_lock);
+	slot->next = free_slots;
+	free_slots = slot;
+	pthread_mutex_unlock(&slot_lock);
+}
+
+struct pcb_t * load(const char * path) {
+	/* Read process code from file, or share it with other processes */
+	return load_proc(load_code(path));
+}
+
+int save_image(struct pcb_t * proc, const char * path) {
+	struct proc_image_hdr hdr;
+	FILE * file;
+
+	if ((file = fopen(path, "wb")) == NULL)
+		return -1;
+	memset(&hdr, 0, sizeof(hdr));
+	hdr.magic = PROC_IMAGE_MAGIC;
+	hdr.version = PROC_IMAGE_VERSION;
+	hdr.priority = proc->priority;
+	hdr.size = proc->code->size;
+	int ok = fwrite(&hdr, sizeof(hdr), 1, file) == 1
+		&& fwrite(proc->code->text, sizeof(struct inst_t),
+			proc->code->size, file) == proc->code->size;
+	/* Flush errors only show up on close */
+	if (fclose(file) != 0)
+		ok = 0;
+	return ok ? 0 : -1;
+}
@@ -0,0 +1,262 @@
+
+#include "log.h"
+#include "timer.h"
+#include <pthread.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#ifndef LOG_OFF
+
+#define LOG_LINE_MAX	256		/* Formatted records fit on the stack */
+
+#ifdef LOG_ASYNC
+
+#define LOG_RING_SIZE	(1 << 16)	/* Bytes per thread, power of two */
+#define LOG_CHUNK	4096		/* Longer records are split */
+#define LOG_POLL_NS	1000000		/* Writer drains rings every 1ms */
+#define LOG_FULL_NS	10000		/* Back-off of a thread on a full ring */
+
+/* Header of a record in a ring, followed by [len] bytes of text */
+struct log_hdr {
+	uint64_t slot;
+	uint64_t seq;
+	uint32_t len;
+};
+
+#define LOG_REC_SIZE(len) \
+	((sizeof(struct log_hdr) + (len) + 7) & ~(uint64_t)7)
+
+/* Single producer (the owner thread), single consumer (the writer) byte
+ * ring. head and tail only grow, the byte at position p is buf[p & mask].
+ * The writer moves the records to pend, in the same layout, where they
+ * wait for their slot to be over. Records of a ring are in (slot, seq)
+ * order, so are the ones in pend */
+struct log_ring {
+	char * buf;
+	uint64_t head;
+	uint64_t tail;
+	char * pend;		// Records from pend_head to pend_tail
+	size_t pend_head;
+	size_t pend_tail;
+	size_t pend_size;
+	struct log_ring * next;
+};
+
+static __thread struct log_ring * my_ring = NULL;
+static struct log_ring * rings = NULL;
+static pthread_mutex_t rings_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static uint64_t log_seq = 0;
+static pthread_t writer;
+static int writer_started = 0;
+static int writer_stop = 0;
+
+static struct log_ring * log_ring_get(void) {
+	if (my_ring == NULL) {
+		struct log_ring * ring = calloc(1, sizeof(struct log_ring));
+		ring->buf = malloc(LOG_RING_SIZE);
+		ring->pend = malloc(LOG_RING_SIZE);
+		ring->pend_size = LOG_RING_SIZE;
+		pthread_mutex_lock(&rings_lock);
+		ring->next = rings;
+		rings = ring;
+		pthread_mutex_unlock(&rings_lock);
+		my_ring = ring;
+	}
+	return my_ring;
+}
+
+static void ring_copy_in(struct log_ring * ring, uint64_t pos,
+		const void * src, uint32_t len) {
+	uint32_t off = pos & (LOG_RING_SIZE - 1);
+	uint32_t first = LOG_RING_SIZE - off;
+	if (first > len)
+		first = len;
+	memcpy(ring->buf + off, src, first);
+	memcpy(ring->buf, (const char *)src + first, len - first);
+}
+
+static void ring_copy_out(struct log_ring * ring, uint64_t pos,
+		void * dst, uint32_t len) {
+	uint32_t off = pos & (LOG_RING_SIZE - 1);
+	uint32_t first = LOG_RING_SIZE - off;
+	if (first > len)
+		first = len;
+	memcpy(dst, ring->buf + off, first);
+	memcpy((char *)dst + first, ring->buf, len - first);
+}
+
+static void ring_put(const char * text, uint32_t len,
+		uint64_t slot, uint64_t seq) {
+	struct log_ring * ring = log_ring_get();
+	struct log_hdr hdr;
+	uint64_t need = LOG_REC_SIZE(len);
+
+	hdr.slot = slot;
+	hdr.seq = seq;
+	hdr.len = len;
+
+	/* Ring is full, wait for the writer to catch up */
+	struct timespec backoff = { 0, LOG_FULL_NS };
+	while (ring->head + need -
+			__atomic_load_n(&ring->tail, __ATOMIC_ACQUIRE) > LOG_RING_SIZE)
+		nanosleep(&backoff, NULL);
+
+	ring_copy_in(ring, ring->head, &hdr, sizeof(hdr));
+	ring_copy_in(ring, ring->head + sizeof(hdr), text, len);
+	__atomic_store_n(&ring->head, ring->head + need, __ATOMIC_RELEASE);
+}
+
+/* Move every record published in the rings to their pending records */
+static void log_collect(void) {
+	struct log_ring * ring;
+	pthread_mutex_lock(&rings_lock);
+	for (ring = rings; ring != NULL; ring = ring->next) {
+		uint64_t head = __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE);
+		size_t len = head - ring->tail;
+		if (len == 0)
+			continue;
+
+		/* Drop what was printed, grow if still short */
+		if (ring->pend_tail + len > ring->pend_size) {
+			size_t used = ring->pend_tail - ring->pend_head;
+			memmove(ring->pend, ring->pend + ring->pend_head, used);
+			ring->pend_head = 0;
+			ring->pend_tail = used;
+			while (used + len > ring->pend_size)
+				ring->pend_size *= 2;
+			ring->pend = realloc(ring->pend, ring->pend_size);
+		}
+		ring_copy_out(ring, ring->tail, ring->pend + ring->pend_tail, len);
+		ring->pend_tail += len;
+		__atomic_store_n(&ring->tail, head, __ATOMIC_RELEASE);
+	}
+	pthread_mutex_unlock(&rings_lock);
+}
+
+/* Print the pending records of every slot before [safe], merging the
+ * rings by (slot, seq) */
+static void log_emit(uint64_t safe) {
+	pthread_mutex_lock(&rings_lock);
+	while (1) {
+		struct log_ring * ring, * min = NULL;
+		struct log_hdr * hdr, * min_hdr = NULL;
+		for (ring = rings; ring != NULL; ring = ring->next) {
+			if (ring->pend_head == ring->pend_tail)
+				continue;
+			hdr = (struct log_hdr *)(ring->pend + ring->pend_head);
+			if (min_hdr == NULL || hdr->slot < min_hdr->slot
+					|| (hdr->slot == min_hdr->slot
+						&& hdr->seq < min_hdr->seq)) {
+				min = ring;
+				min_hdr = hdr;
+			}
+		}
+		if (min_hdr == NULL || min_hdr->slot >= safe)
+			break;
+		fwrite(min_hdr + 1, 1, min_hdr->len, stdout);
+		min->pend_head += LOG_REC_SIZE(min_hdr->len);
+	}
+	pthread_mutex_unlock(&rings_lock);
+	fflush(stdout);
+}
+
+static void * log_writer(void * args) {
+	struct timespec poll = { 0, LOG_POLL_NS };
+	while (!__atomic_load_n(&writer_stop, __ATOMIC_ACQUIRE)) {
+		/* Records of a slot are all published once the clock has
+		 * left it, read the clock before collecting */
+		uint64_t safe = current_time();
+		log_collect();
+		log_emit(safe);
+		nanosleep(&poll, NULL);
+	}
+	log_collect();
+	log_emit(UINT64_MAX);
+	return NULL;
+}
+
+void log_start(void) {
+	writer_stop = 0;
+	writer_started = 1;
+	pthread_create(&writer, NULL, log_writer, NULL);
+}
+
+void log_stop(void) {
+	if (!writer_started)
+		return;
+	__atomic_store_n(&writer_stop, 1, __ATOMIC_RELEASE);
+	pthread_join(writer, NULL);
+	writer_started = 0;
+
+	while (rings != NULL) {
+		struct log_ring * ring = rings;
+		rings = ring->next;
+		free(ring->buf);
+		free(ring->pend);
+		free(ring);
+	}
+	my_ring = NULL;
+}
+
+void log_write(const char * buf, int len) {
+	if (!writer_started) {
+		fwrite(buf, 1, len, stdout);
+		return;
+	}
+
+	/* The chunks of a long record take consecutive sequence numbers in
+	 * one slot, no other record can come in between */
+	uint64_t nchunks = (len > LOG_CHUNK) ? (len + LOG_CHUNK - 1) / LOG_CHUNK : 1;
+	uint64_t slot = current_time();
+	uint64_t seq = __atomic_fetch_add(&log_seq, nchunks, __ATOMIC_RELAXED);
+	while (len > LOG_CHUNK) {
+		ring_put(buf, LOG_CHUNK, slot, seq++);
+		buf += LOG_CHUNK;
+		len -= LOG_CHUNK;
+	}
+	ring_put(buf, len, slot, seq);
+}
+
+#else /* !LOG_ASYNC */
+
+void log_start(void) {
+}
+
+void log_stop(void) {
+	fflush(stdout);
+}
+
+void log_write(const char * buf, int len) {
+	fwrite(buf, 1, len, stdout);
+}
+
+#endif /* LOG_ASYNC */
+
+void log_printf(const char * fmt, ...) {
+	char line[LOG_LINE_MAX];
+	va_list ap;
+
+	va_start(ap, fmt);
+	int len = vsnprintf(line, sizeof(line), fmt, ap);
+	va_end(ap);
+	if (len < 0)
+		return;
+	if (len < (int)sizeof(line)) {
+		log_write(line, len);
+		return;
+	}
+
+	char * buf = malloc(len + 1);
+	va_start(ap, fmt);
+	vsnprintf(buf, len + 1, fmt, ap);
+	va_end(ap);
+	log_write(buf, len);
+	free(buf);
+}
+
+#endif /* LOG_OFF */
+
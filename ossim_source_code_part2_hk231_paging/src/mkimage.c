@@ -0,0 +1,45 @@
+
+/*
+ * Convert programs from the text format of input/proc to process images.
+ * Usage: mkimage [text program] [image]
+ *        mkimage -d [output dir] [text program]...
+ * The second form writes [output dir]/<name of the program> for each one.
+ */
+
+#include "loader.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+static int convert(const char * src, const char * dst) {
+	struct pcb_t * proc = load(src);
+	int stat = save_image(proc, dst);
+	if (stat != 0)
+		printf("Cannot write process image '%s'\n", dst);
+	free_proc(proc);
+	return stat;
+}
+
+int main(int argc, char * argv[]) {
+	int i, stat = 0;
+
+	if (argc == 3 && strcmp(argv[1], "-d") != 0)
+		return convert(argv[1], argv[2]) ? 1 : 0;
+	if (argc < 4 || strcmp(argv[1], "-d") != 0) {
+		printf("Usage: mkimage [text program] [image]\n"
+			"       mkimage -d [output dir] [text program]...\n");
+		return 1;
+	}
+
+	for (i = 3; i < argc; i++) {
+		const char * name = strrchr(argv[i], '/');
+		name = (name != NULL) ? name + 1 : argv[i];
+		char * dst = malloc(strlen(argv[2]) + strlen(name) + 2);
+		sprintf(dst, "%s/%s", argv[2], name);
+		if (convert(argv[i], dst) != 0)
+			stat = 1;
+		free(dst);
+	}
+	return stat;
+}
+
@@ -0,0 +1,309 @@
+
+/*
+ * Synthetic workload generator
+ * Writes a configuration input/[name] and its programs under
+ * input/proc/[name]/, from a description of the load:
+ *   -n processes       number of processes (100)
+ *   -u programs        number of distinct programs, processes pick one at
+ *                      random so they share code (= processes)
+ *   -c cpus -t slot    CPUs and time slice (2, 2)
+ *   -a burst|uniform|poisson
+ *                      arrivals: all at slot 0, every -g slots, or with
+ *                      exponential gaps of mean -g (poisson)
+ *   -g gap             mean slots between two arrivals (1)
+ *   -p prio:weight,... priority mix, e.g. 0:10,70:60,139:30 (uniform)
+ *   -l length          instructions per program (50)
+ *   -r calc:alloc:free:read:write[:copy:fill:compare]
+ *                      instruction mix in relative weights (50:10:5:20:15,
+ *                      no block operation)
+ *   -w regions         regions a program works on, at most 10 (4)
+ *   -s size            bytes of a region (256)
+ *   -L locality        0..100, chance in percent that an access goes to the
+ *                      region of the previous one, close to it (50)
+ *   -m "ram swp0 swp1 swp2 swp3"
+ *                      memory line (1048576 16777216 0 0 0), "" for none
+ *   -d seed            random seed (1)
+ */
+
+#include "common.h"
+#include <errno.h>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#define MKLOAD_MAX_REGIONS	10	/* Registers of a process */
+#define MKLOAD_MAX_PRIOS	MAX_PRIO
+
+enum { ARRIVE_BURST, ARRIVE_UNIFORM, ARRIVE_POISSON };
+enum { MIX_CALC, MIX_ALLOC, MIX_FREE, MIX_READ, MIX_WRITE,
+	MIX_COPY, MIX_FILL, MIX_COMPARE, NR_MIX };
+
+struct load_desc {
+	const char * name;
+	int nprocs;
+	int nprogs;
+	int num_cpus;
+	int time_slot;
+	int arrival;
+	double gap;
+	int prio[MKLOAD_MAX_PRIOS];	// Priorities of the mix
+	int prio_weight[MKLOAD_MAX_PRIOS];
+	int nr_prios;
+	int length;
+	int mix[NR_MIX];
+	int regions;
+	int region_size;
+	int locality;
+	const char * mem;
+};
+
+static uint64_t rng_state;
+
+/* xorshift64*, the same seed always gives the same workload */
+static uint64_t rng_next(void) {
+	rng_state ^= rng_state >> 12;
+	rng_state ^= rng_state << 25;
+	rng_state ^= rng_state >> 27;
+	return rng_state * 0x2545f4914f6cdd1dUL;
+}
+
+static int rng_below(int n) {
+	return (n > 0) ? (int)(rng_next() % n) : 0;
+}
+
+static double rng_unit(void) {
+	return (rng_next() >> 11) * (1.0 / 9007199254740992.0);
+}
+
+static int pick_weighted(const int * weight, int n) {
+	int i, total = 0;
+	for (i = 0; i < n; i++)
+		total += weight[i];
+	int r = rng_below(total);
+	for (i = 0; i < n; i++) {
+		if (r < weight[i])
+			return i;
+		r -= weight[i];
+	}
+	return n - 1;
+}
+
+static void usage(void) {
+	printf("Usage: mkload [-n processes] [-u programs] [-c cpus] "
+		"[-t slot]\n"
+		"              [-a burst|uniform|poisson] [-g gap] "
+		"[-p prio:weight,...]\n"
+		"              [-l length] "
+		"[-r calc:alloc:free:read:write[:copy:fill:compare]]\n"
+		"              [-w regions]"
+		" [-s size] [-L locality] [-m mem] [-d seed] [name]\n");
+	exit(1);
+}
+
+static void parse_prios(struct load_desc * desc, char * arg) {
+	char * tok;
+	desc->nr_prios = 0;
+	for (tok = strtok(arg, ","); tok != NULL; tok = strtok(NULL, ",")) {
+		int prio, weight = 1;
+		if (sscanf(tok, "%d:%d", &prio, &weight) < 1
+				|| prio < 0 || prio >= MAX_PRIO || weight < 0
+				|| desc->nr_prios == MKLOAD_MAX_PRIOS)
+			usage();
+		desc->prio[desc->nr_prios] = prio;
+		desc->prio_weight[desc->nr_prios++] = weight;
+	}
+}
+
+/* A random allocated region */
+static int pick_region(struct load_desc * desc, const int * allocated) {
+	int reg;
+	do
+		reg = rng_below(desc->regions);
+	while (!allocated[reg]);
+	return reg;
+}
+
+/* Write one program, every access goes to an allocated region */
+static void gen_program(struct load_desc * desc, FILE * file) {
+	int allocated[MKLOAD_MAX_REGIONS] = { 0 };
+	int nr_allocated = 0;
+	int last_reg = -1, last_off = 0;
+	int i, reg, off;
+
+	fprintf(file, "%d %d\n", desc->nr_prios
+		? desc->prio[pick_weighted(desc->prio_weight, desc->nr_prios)]
+		: rng_below(MAX_PRIO), desc->length);
+	for (i = 0; i < desc->length; i++) {
+		int op = pick_weighted(desc->mix, NR_MIX);
+
+		/* Nothing to touch yet, or nothing left to allocate */
+		if (nr_allocated == 0 && op != MIX_CALC)
+			op = MIX_ALLOC;
+		if (op == MIX_ALLOC && nr_allocated == desc->regions)
+			op = MIX_WRITE;
+
+		switch (op) {
+		case MIX_CALC:
+			fprintf(file, "calc\n");
+			continue;
+		case MIX_ALLOC:
+			do
+				reg = rng_below(desc->regions);
+			while (allocated[reg]);
+			allocated[reg] = 1;
+			nr_allocated++;
+			fprintf(file, "alloc %d %d\n", desc->region_size, reg);
+			continue;
+		case MIX_FREE:
+			do
+				reg = rng_below(desc->regions);
+			while (!allocated[reg]);
+			allocated[reg] = 0;
+			nr_allocated--;
+			if (reg == last_reg)
+				last_reg = -1;
+			fprintf(file, "free %d\n", reg);
+			continue;
+		case MIX_COPY:
+		case MIX_FILL:
+		case MIX_COMPARE: {
+			/* A block of the region, the same length in both */
+			int len = 1 + rng_below(desc->region_size);
+			int reg2 = pick_region(desc, allocated);
+			int off2 = rng_below(desc->region_size - len + 1);
+			reg = pick_region(desc, allocated);
+			off = rng_below(desc->region_size - len + 1);
+			if (op == MIX_FILL)
+				fprintf(file, "fill %d %d %d %d\n",
+					reg, off, len, rng_below(256));
+			else
+				fprintf(file, "%s %d %d %d %d %d\n",
+					(op == MIX_COPY) ? "copy" : "compare",
+					reg, off, reg2, off2, len);
+			continue;
+		}
+		}
+
+		/* Read or write, close to the previous access if local */
+		if (last_reg >= 0 && rng_below(100) < desc->locality) {
+			reg = last_reg;
+			off = (last_off + rng_below(16)) % desc->region_size;
+		} else {
+			reg = pick_region(desc, allocated);
+			off = rng_below(desc->region_size);
+		}
+		last_reg = reg;
+		last_off = off;
+		if (op == MIX_READ)
+			fprintf(file, "read %d %d %d\n", reg, off,
+				rng_below(MKLOAD_MAX_REGIONS));
+		else
+			fprintf(file, "write %d %d %d\n", rng_below(256), reg, off);
+	}
+}
+
+int main(int argc, char * argv[]) {
+	struct load_desc desc = {
+		.name = "load", .nprocs = 100, .nprogs = 0,
+		.num_cpus = 2, .time_slot = 2,
+		.arrival = ARRIVE_UNIFORM, .gap = 1,
+		.length = 50, .mix = { 50, 10, 5, 20, 15, 0, 0, 0 },
+		.regions = 4, .region_size = 256, .locality = 50,
+		.mem = "1048576 16777216 0 0 0",
+	};
+	char path[256];
+	FILE * file;
+	int opt, i;
+
+	rng_state = 1;
+	while ((opt = getopt(argc, argv, "n:u:c:t:a:g:p:l:r:w:s:L:m:d:")) != -1) {
+		switch (opt) {
+		case 'n': desc.nprocs = atoi(optarg); break;
+		case 'u': desc.nprogs = atoi(optarg); break;
+		case 'c': desc.num_cpus = atoi(optarg); break;
+		case 't': desc.time_slot = atoi(optarg); break;
+		case 'a':
+			if (!strcmp(optarg, "burst"))
+				desc.arrival = ARRIVE_BURST;
+			else if (!strcmp(optarg, "uniform"))
+				desc.arrival = ARRIVE_UNIFORM;
+			else if (!strcmp(optarg, "poisson"))
+				desc.arrival = ARRIVE_POISSON;
+			else
+				usage();
+			break;
+		case 'g': desc.gap = atof(optarg); break;
+		case 'p': parse_prios(&desc, optarg); break;
+		case 'l': desc.length = atoi(optarg); break;
+		case 'r':
+			desc.mix[MIX_COPY] = desc.mix[MIX_FILL] = 0;
+			desc.mix[MIX_COMPARE] = 0;
+			i = sscanf(optarg, "%d:%d:%d:%d:%d:%d:%d:%d",
+				&desc.mix[MIX_CALC], &desc.mix[MIX_ALLOC],
+				&desc.mix[MIX_FREE], &desc.mix[MIX_READ],
+				&desc.mix[MIX_WRITE], &desc.mix[MIX_COPY],
+				&desc.mix[MIX_FILL], &desc.mix[MIX_COMPARE]);
+			if (i != 5 && i != 8)
+				usage();
+			break;
+		case 'w': desc.regions = atoi(optarg); break;
+		case 's': desc.region_size = atoi(optarg); break;
+		case 'L': desc.locality = atoi(optarg); break;
+		case 'm': desc.mem = optarg; break;
+		case 'd': rng_state = strtoull(optarg, NULL, 0) | 1; break;
+		default: usage();
+		}
+	}
+	if (optind < argc)
+		desc.name = argv[optind];
+	if (desc.nprogs <= 0 || desc.nprogs > desc.nprocs)
+		desc.nprogs = desc.nprocs;
+	if (desc.nprocs <= 0 || desc.length <= 0 || desc.region_size <= 0
+			|| desc.regions <= 0 || desc.regions > MKLOAD_MAX_REGIONS)
+		usage();
+
+	/* Programs */
+	snprintf(path, sizeof(path), "input/proc/%s", desc.name);
+	if (mkdir(path, 0755) != 0 && errno != EEXIST) {
+		printf("Cannot create %s\n", path);
+		return 1;
+	}
+	for (i = 0; i < desc.nprogs; i++) {
+		snprintf(path, sizeof(path), "input/proc/%s/p%d", desc.name, i);
+		if ((file = fopen(path, "w")) == NULL) {
+			printf("Cannot write %s\n", path);
+			return 1;
+		}
+		gen_program(&desc, file);
+		fclose(file);
+	}
+
+	/* Configuration, arrivals in order */
+	snprintf(path, sizeof(path), "input/%s", desc.name);
+	if ((file = fopen(path, "w")) == NULL) {
+		printf("Cannot write %s\n", path);
+		return 1;
+	}
+	fprintf(file, "%d %d %d\n", desc.time_slot, desc.num_cpus, desc.nprocs);
+	if (desc.mem[0] != '\0')
+		fprintf(file, "%s\n", desc.mem);
+	double arrive = 0;
+	for (i = 0; i < desc.nprocs; i++) {
+		int prog = (desc.nprogs == desc.nprocs) ? i : rng_below(desc.nprogs);
+		fprintf(file, "%lu %s/p%d %d\n", (unsigned long)arrive,
+			desc.name, prog, desc.nr_prios
+			? desc.prio[pick_weighted(desc.prio_weight, desc.nr_prios)]
+			: rng_below(MAX_PRIO));
+		if (desc.arrival == ARRIVE_UNIFORM)
+			arrive += desc.gap;
+		else if (desc.arrival == ARRIVE_POISSON)
+			arrive += -desc.gap * log1p(-rng_unit());
+	}
+	fclose(file);
+	printf("%s: %d processes, %d programs\n", path, desc.nprocs, desc.nprogs);
+	return 0;
+}
+
@@ -5,7 +5,10 @@
  */
 
 #include "mm.h"
+#include "log.h"
+#include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 
 /*
  *  MEMPHY_mv_csr - move MEMPHY cursor
@@ -105,52 +108,284 @@ int MEMPHY_write(struct memphy_struct * mp, int addr, BYTE data)
    return 0;
 }
 
+/*
+ *  MEMPHY_copy - copy a range of MEMPHY device, ranges may overlap
+ *  @mp: memphy struct
+ *  @dst: destination address
+ *  @src: source address
+ *  @len: number of bytes
+ */
+int MEMPHY_copy(struct memphy_struct *mp, int dst, int src, int len)
+{
+   BYTE value;
+   int i;
+
+   if (mp == NULL || len < 0 || src + len > mp->maxsz || dst + len > mp->maxsz)
+     return -1;
+
+   if (mp->rdmflg) {
+      memmove(mp->storage + dst, mp->storage + src, len);
+      return 0;
+   }
+
+   /* Sequential access device, go byte by byte in the safe direction */
+   for (i = 0; i < len; i++) {
+      int k = (dst > src) ? len - 1 - i : i;
+      MEMPHY_read(mp, src + k, &value);
+      MEMPHY_write(mp, dst + k, value);
+   }
+   return 0;
+}
+
+/*
+ *  MEMPHY_fill - set a range of MEMPHY device to one value
+ *  @mp: memphy struct
+ *  @addr: address
+ *  @value: written data
+ *  @len: number of bytes
+ */
+int MEMPHY_fill(struct memphy_struct *mp, int addr, BYTE value, int len)
+{
+   int i;
+
+   if (mp == NULL || len < 0 || addr + len > mp->maxsz)
+     return -1;
+
+   if (mp->rdmflg) {
+      memset(mp->storage + addr, value, len);
+      return 0;
+   }
+
+   for (i = 0; i < len; i++)
+      MEMPHY_write(mp, addr + i, value);
+   return 0;
+}
+
+/*
+ *  MEMPHY_compare - compare two ranges of MEMPHY device
+ *  @mp: memphy struct
+ *  @a: address of the first range
+ *  @b: address of the second range
+ *  @len: number of bytes
+ *  @result: <0, 0 or >0 as memcmp
+ */
+int MEMPHY_compare(struct memphy_struct *mp, int a, int b, int len, int *result)
+{
+   BYTE va, vb;
+   int i;
+
+   if (mp == NULL || len < 0 || a + len > mp->maxsz || b + len > mp->maxsz)
+     return -1;
+
+   if (mp->rdmflg) {
+      *result = memcmp(mp->storage + a, mp->storage + b, len);
+      return 0;
+   }
+
+   *result = 0;
+   for (i = 0; i < len && *result == 0; i++) {
+      MEMPHY_read(mp, a + i, &va);
+      MEMPHY_read(mp, b + i, &vb);
+      *result = (unsigned char)va - (unsigned char)vb;
+   }
+   return 0;
+}
+
+/*
+ *  buddy_set - mark a block free, without merging
+ */
+static void buddy_set(struct memphy_struct *mp, int fpn, int order)
+{
+   int blk = fpn >> order;
+
+   __set_bit(blk, mp->free_map[order]);
+   mp->nr_blocks[order]++;
+   if (BITMAP_WORD(blk) < mp->hint[order])
+      mp->hint[order] = BITMAP_WORD(blk);
+}
+
+/*
+ *  buddy_take - take a free block of [order], splitting a larger one
+ *  Return its first frame, -1 if there is none. The caller holds the lock
+ */
+static int buddy_take(struct memphy_struct *mp, int order)
+{
+   int k, i, fpn;
+
+   for (k = order; k <= MEMPHY_MAX_ORDER && mp->nr_blocks[k] == 0; k++)
+      ;
+   if (k > MEMPHY_MAX_ORDER)
+      return -1;
+
+   /* A block of order k is free, none in the words before the hint */
+   for (i = mp->hint[k]; mp->free_map[k][i] == 0; i++)
+      ;
+   mp->hint[k] = i;
+   fpn = i * BITMAP_WORD_BITS + __ffs(mp->free_map[k][i]);
+   __clear_bit(fpn, mp->free_map[k]);
+   mp->nr_blocks[k]--;
+   fpn <<= k;
+
+   /* Keep the lower half, the upper one is free */
+   while (k > order) {
+      k--;
+      buddy_set(mp, fpn + (1 << k), k);
+   }
+   mp->nr_free -= 1 << order;
+
+   return fpn;
+}
+
+/*
+ *  buddy_give - give back a block, merged with its buddy as long as the
+ *  buddy is free. The caller holds the lock
+ */
+static void buddy_give(struct memphy_struct *mp, int fpn, int order)
+{
+   mp->nr_free += 1 << order;
+   while (order < MEMPHY_MAX_ORDER) {
+      int buddy = (fpn >> order) ^ 1;
+
+      if (!test_bit(buddy, mp->free_map[order]))
+         break;
+      __clear_bit(buddy, mp->free_map[order]);
+      mp->nr_blocks[order]--;
+      fpn &= ~(1 << order);
+      order++;
+   }
+   buddy_set(mp, fpn, order);
+}
+
 /*
  *  MEMPHY_format-format MEMPHY device
  *  @mp: memphy struct
+ *  Free frames are kept by a buddy allocator: one bitmap of free blocks
+ *  per order, all in one allocation. The device starts as blocks of the
+ *  largest order, then one block per smaller order for the rest.
  */
 int MEMPHY_format(struct memphy_struct *mp, int pagesz)
 {
     /* This setting come with fixed constant PAGESZ */
     int numfp = mp->maxsz / pagesz;
-    struct framephy_struct *newfst, *fst;
-    int iter = 0;
-
-    if (numfp <= 0)
-      return -1;
-
-    /* Init head of free framephy list */
-    fst = malloc(sizeof(struct framephy_struct));
-    fst->fpn = iter;
-    mp->free_fp_list = fst;
-
-    /* We have list with first element, fill in the rest num-1 element member*/
-    for (iter = 1; iter < numfp ; iter++)
-    {
-       newfst =  malloc(sizeof(struct framephy_struct));
-       newfst->fpn = iter;
-       newfst->fp_next = NULL;
-       fst->fp_next = newfst;
-       fst = newfst;
+    unsigned long *map;
+    int k, fpn, nwords = 0;
+
+    if (numfp < 0)
+      numfp = 0;
+
+    /* A buddy may be one block past the last one */
+    for (k = 0; k <= MEMPHY_MAX_ORDER; k++)
+      nwords += BITS_TO_LONGS((numfp >> k) + 2);
+    map = calloc(nwords, sizeof(unsigned long));
+    for (k = 0; k <= MEMPHY_MAX_ORDER; k++) {
+      mp->free_map[k] = map;
+      mp->nr_blocks[k] = 0;
+      mp->hint[k] = 0;
+      map += BITS_TO_LONGS((numfp >> k) + 2);
     }
 
-    return 0;
+    for (fpn = 0, k = MEMPHY_MAX_ORDER; k >= 0; k--)
+      while (fpn + (1 << k) <= numfp) {
+        buddy_set(mp, fpn, k);
+        fpn += 1 << k;
+      }
+    mp->nr_frames = numfp;
+    mp->nr_free = numfp;
+    pthread_mutex_init(&mp->lock, NULL);
+
+    return (numfp > 0) ? 0 : -1;
 }
 
 int MEMPHY_get_freefp(struct memphy_struct *mp, int *retfpn)
 {
-   struct framephy_struct *fp = mp->free_fp_list;
+   return MEMPHY_get_freefp_order(mp, 0, retfpn);
+}
+
+/*
+ *  MEMPHY_get_freefp_order - take a run of 2^order contiguous frames
+ *  @mp: memphy struct
+ *  @order: order of the run
+ *  @retfpn: first frame of the run, aligned on the run size
+ */
+int MEMPHY_get_freefp_order(struct memphy_struct *mp, int order, int *retfpn)
+{
+   int fpn;
 
-   if (fp == NULL)
-     return -1;
+   if (order < 0 || order > MEMPHY_MAX_ORDER)
+      return -1;
+   pthread_mutex_lock(&mp->lock);
+   fpn = buddy_take(mp, order);
+   pthread_mutex_unlock(&mp->lock);
+   if (fpn < 0)
+      return -1;
+   *retfpn = fpn;
 
-   *retfpn = fp->fpn;
-   mp->free_fp_list = fp->fp_next;
+   return 0;
+}
+
+/*
+ *  MEMPHY_get_freefp_range - take [n] free frames at once
+ *  @mp: memphy struct
+ *  @n: number of frames
+ *  @fpns: returned frames
+ *  The frames come in runs as long as the free blocks allow, the largest
+ *  first. Takes nothing and returns -1 if fewer than [n] frames are free
+ */
+int MEMPHY_get_freefp_range(struct memphy_struct *mp, int n, int *fpns)
+{
+   int order, fpn, i, got = 0;
+
+   if (n <= 0)
+      return 0;
+   pthread_mutex_lock(&mp->lock);
+   if (mp->nr_free < n) {
+      pthread_mutex_unlock(&mp->lock);
+      return -1;
+   }
+
+   while (got < n) {
+      order = __fls(n - got);
+      if (order > MEMPHY_MAX_ORDER)
+         order = MEMPHY_MAX_ORDER;
+      /* A free frame is left, some order down to 0 has a block */
+      while ((fpn = buddy_take(mp, order)) < 0)
+         order--;
+      for (i = 0; i < (1 << order); i++)
+         fpns[got++] = fpn + i;
+   }
+   pthread_mutex_unlock(&mp->lock);
+
+   return 0;
+}
 
-   /* MEMPHY is iteratively used up until its exhausted
-    * No garbage collector acting then it not been released
-    */
-   free(fp);
+/*
+ *  MEMPHY_put_freefp_range - give back [n] frames at once
+ *  @mp: memphy struct
+ *  @n: number of frames
+ *  @fpns: the frames
+ *  Runs of contiguous frames go back as the largest aligned blocks
+ */
+int MEMPHY_put_freefp_range(struct memphy_struct *mp, int n, const int *fpns)
+{
+   int i, run, order;
+
+   pthread_mutex_lock(&mp->lock);
+   for (i = 0; i < n; i += run) {
+      for (run = 1; i + run < n && fpns[i + run] == fpns[i] + run; run++)
+         ;
+      int fpn = fpns[i], left = run;
+      while (left > 0) {
+         order = __fls(left);
+         if (fpn != 0 && __ffs(fpn) < order)
+            order = __ffs(fpn);
+         if (order > MEMPHY_MAX_ORDER)
+            order = MEMPHY_MAX_ORDER;
+         buddy_give(mp, fpn, order);
+         fpn += 1 << order;
+         left -= 1 << order;
+      }
+   }
+   pthread_mutex_unlock(&mp->lock);
 
    return 0;
 }
@@ -160,26 +395,65 @@ int MEMPHY_dump(struct memphy_struct * mp)
     /*TODO dump memphy contnt mp->storage
      *     for tracing the memory content
      */
-   int i;
-   for (i = 0; i < mp->maxsz; i++) {
-      printf("%c", mp->storage[i]);
-   }
+   log_write(mp->storage, mp->maxsz);
     return 0;
 }
 
 int MEMPHY_put_freefp(struct memphy_struct *mp, int fpn)
 {
-   struct framephy_struct *fp = mp->free_fp_list;
-   struct framephy_struct *newnode = malloc(sizeof(struct framephy_struct));
+   return MEMPHY_put_freefp_order(mp, fpn, 0);
+}
 
-   /* Create new node with value fpn */
-   newnode->fpn = fpn;
-   newnode->fp_next = fp;
-   mp->free_fp_list = newnode;
+/*
+ *  MEMPHY_put_freefp_order - give back a run of 2^order frames
+ *  @mp: memphy struct
+ *  @fpn: first frame of the run
+ *  @order: order of the run
+ */
+int MEMPHY_put_freefp_order(struct memphy_struct *mp, int fpn, int order)
+{
+   pthread_mutex_lock(&mp->lock);
+   buddy_give(mp, fpn, order);
+   pthread_mutex_unlock(&mp->lock);
 
    return 0;
 }
 
+/* Number of free and of used frames */
+int MEMPHY_nr_free(struct memphy_struct *mp)
+{
+   return __atomic_load_n(&mp->nr_free, __ATOMIC_RELAXED);
+}
+
+int MEMPHY_nr_used(struct memphy_struct *mp)
+{
+   return mp->nr_frames - MEMPHY_nr_free(mp);
+}
+
+/*
+ *  MEMPHY_dump_frag - print the free blocks of every order to stderr
+ *  @mp: memphy struct
+ *  @name: name of the device
+ *  unusable% of an order is the share of free frames in smaller blocks,
+ *  that a run of this order cannot use
+ */
+void MEMPHY_dump_frag(struct memphy_struct *mp, const char *name)
+{
+   int k, small = 0;
+
+   pthread_mutex_lock(&mp->lock);
+   fprintf(stderr, "frag: %s %d frames, %d free\n",
+           name, mp->nr_frames, mp->nr_free);
+   fprintf(stderr, "frag: %-6s %8s %8s %10s\n",
+           "order", "blocks", "frames", "unusable%");
+   for (k = 0; k <= MEMPHY_MAX_ORDER; k++) {
+      fprintf(stderr, "frag: %-6d %8d %8d %9.2f%%\n", k, mp->nr_blocks[k],
+              mp->nr_blocks[k] << k,
+              mp->nr_free ? 100.0 * small / mp->nr_free : 0.0);
+      small += mp->nr_blocks[k] << k;
+   }
+   pthread_mutex_unlock(&mp->lock);
+}
 
 /*
  *  Init MEMPHY struct
@@ -199,4 +473,18 @@ int init_memphy(struct memphy_struct *mp, int max_size, int randomflg)
    return 0;
 }
 
+/*
+ *  Release the storage and the free block bitmaps of a MEMPHY
+ */
+int free_memphy(struct memphy_struct *mp)
+{
+   free(mp->free_map[0]);
+   memset(mp->free_map, 0, sizeof(mp->free_map));
+   pthread_mutex_destroy(&mp->lock);
+   free(mp->storage);
+   mp->storage = NULL;
+
+   return 0;
+}
+
 //#endif
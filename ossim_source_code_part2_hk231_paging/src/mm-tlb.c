@@ -0,0 +1,102 @@
+
+#include "mm-tlb.h"
+#include "mm.h"
+#include <stdio.h>
+#include <stdlib.h>
+
+#ifdef MM_TLB
+
+/* Entry: valid bit, 31 bits of pid, TLB_PGN_BITS of pgn, then the fpn */
+#define TLB_FPN_BITS	13	/* PAGING_PTE_FPN_MASK */
+#define TLB_PGN_BITS	19
+#define TLB_VALID	(1UL << 63)
+#define TLB_KEY(pid, pgn) \
+	(TLB_VALID | ((uint64_t)(pid) << (TLB_PGN_BITS + TLB_FPN_BITS)) \
+		| ((uint64_t)(pgn) << TLB_FPN_BITS))
+#define TLB_KEY_MASK	(~(uint64_t)0 << TLB_FPN_BITS)
+#define TLB_INDEX(pid, pgn) \
+	(((pgn) ^ ((pid) * 0x9e3779b1U)) & (MM_TLB - 1))
+
+struct tlb {
+	uint64_t ent[MM_TLB];
+	struct tlb_stat stat;
+} __attribute__((aligned(64)));
+
+static struct tlb * tlbs = NULL;
+static int nr_tlbs = 0;
+static __thread struct tlb * my_tlb = NULL;
+
+void tlb_init(int num_cpus) {
+	tlbs = aligned_alloc(64, sizeof(struct tlb) * num_cpus);
+	nr_tlbs = num_cpus;
+	int i, j;
+	for (i = 0; i < num_cpus; i++) {
+		for (j = 0; j < MM_TLB; j++)
+			tlbs[i].ent[j] = 0;
+		tlbs[i].stat.hits = tlbs[i].stat.misses = 0;
+	}
+}
+
+void tlb_set_cpu(int cpu) {
+	my_tlb = (tlbs != NULL && cpu < nr_tlbs) ? &tlbs[cpu] : NULL;
+}
+
+int tlb_lookup(uint32_t pid, uint32_t pgn, int * fpn) {
+	struct tlb * tlb = my_tlb;
+	if (tlb == NULL)
+		return 0;
+	uint64_t ent = __atomic_load_n(&tlb->ent[TLB_INDEX(pid, pgn)],
+		__ATOMIC_RELAXED);
+	if ((ent & TLB_KEY_MASK) != TLB_KEY(pid, pgn)) {
+		tlb->stat.misses++;
+		return 0;
+	}
+	tlb->stat.hits++;
+	*fpn = ent & ~TLB_KEY_MASK;
+	return 1;
+}
+
+void tlb_insert(uint32_t pid, uint32_t pgn, int fpn) {
+	struct tlb * tlb = my_tlb;
+	if (tlb == NULL || pgn >= (1U << TLB_PGN_BITS) || pid >= (1U << 31))
+		return;
+	__atomic_store_n(&tlb->ent[TLB_INDEX(pid, pgn)],
+		TLB_KEY(pid, pgn) | (uint64_t)fpn, __ATOMIC_RELAXED);
+}
+
+void tlb_invalidate(uint32_t pid, uint32_t pgn) {
+	uint32_t idx = TLB_INDEX(pid, pgn);
+	int i;
+	for (i = 0; i < nr_tlbs; i++) {
+		uint64_t ent = __atomic_load_n(&tlbs[i].ent[idx], __ATOMIC_RELAXED);
+		/* Leave the slot alone if another page took it meanwhile */
+		if ((ent & TLB_KEY_MASK) == TLB_KEY(pid, pgn))
+			__atomic_compare_exchange_n(&tlbs[i].ent[idx], &ent, 0, 0,
+				__ATOMIC_RELAXED, __ATOMIC_RELAXED);
+	}
+}
+
+struct tlb_stat tlb_get_stat(int cpu) {
+	return tlbs[cpu].stat;
+}
+
+void tlb_finish(void) {
+#ifdef MM_TLB_STATS
+	int i;
+	for (i = 0; i < nr_tlbs; i++) {
+		struct tlb_stat * st = &tlbs[i].stat;
+		unsigned long total = st->hits + st->misses;
+		fprintf(stderr, "tlb: cpu %d %lu hits %lu misses (%.2f%% hit, "
+			"%d entries, %d B pages)\n", i, st->hits, st->misses,
+			total ? 100.0 * st->hits / total : 0.0,
+			MM_TLB, PAGING_PAGESZ);
+	}
+#endif
+	free(tlbs);
+	tlbs = NULL;
+	nr_tlbs = 0;
+	my_tlb = NULL;
+}
+
+#endif
+
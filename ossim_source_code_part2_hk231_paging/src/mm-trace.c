@@ -0,0 +1,92 @@
+
+#include "mm-trace.h"
+#include "mm.h"
+#include "timer.h"
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#ifdef MM_TRACE
+
+#define MM_TRACE_BUF	4096	/* Records buffered per thread */
+
+struct mm_trace_buf {
+	struct mm_trace_rec rec[MM_TRACE_BUF];
+	int nr_rec;
+	struct mm_trace_buf * next;
+};
+
+static __thread struct mm_trace_buf * my_buf = NULL;
+static struct mm_trace_buf * bufs = NULL;
+static pthread_mutex_t trace_lock = PTHREAD_MUTEX_INITIALIZER;
+static FILE * trace_file = NULL;
+
+/* Caller must hold trace_lock */
+static void mm_trace_flush(struct mm_trace_buf * buf) {
+	fwrite(buf->rec, sizeof(struct mm_trace_rec), buf->nr_rec, trace_file);
+	buf->nr_rec = 0;
+}
+
+int mm_trace_start(const char * path) {
+	struct mm_trace_hdr hdr = {
+		.magic = MM_TRACE_MAGIC,
+		.version = MM_TRACE_VERSION,
+		.rec_size = sizeof(struct mm_trace_rec),
+		.page_size = PAGING_PAGESZ,
+	};
+
+	if ((trace_file = fopen(path, "wb")) == NULL) {
+		fprintf(stderr, "mm-trace: cannot write %s\n", path);
+		return -1;
+	}
+	fwrite(&hdr, sizeof(hdr), 1, trace_file);
+	return 0;
+}
+
+void mm_trace(uint32_t pid, uint32_t pgn, uint32_t off, enum mm_trace_op op) {
+	struct mm_trace_buf * buf = my_buf;
+
+	if (trace_file == NULL)
+		return;
+	if (buf == NULL) {
+		buf = calloc(1, sizeof(struct mm_trace_buf));
+		pthread_mutex_lock(&trace_lock);
+		buf->next = bufs;
+		bufs = buf;
+		pthread_mutex_unlock(&trace_lock);
+		my_buf = buf;
+	}
+
+	struct mm_trace_rec * rec = &buf->rec[buf->nr_rec++];
+	rec->slot = current_time();
+	rec->pid = pid;
+	rec->pgn = pgn;
+	rec->off = off;
+	rec->op = op;
+	rec->pad = 0;
+
+	if (buf->nr_rec == MM_TRACE_BUF) {
+		pthread_mutex_lock(&trace_lock);
+		mm_trace_flush(buf);
+		pthread_mutex_unlock(&trace_lock);
+	}
+}
+
+void mm_trace_stop(void) {
+	if (trace_file == NULL)
+		return;
+	pthread_mutex_lock(&trace_lock);
+	while (bufs != NULL) {
+		struct mm_trace_buf * buf = bufs;
+		bufs = buf->next;
+		mm_trace_flush(buf);
+		free(buf);
+	}
+	fclose(trace_file);
+	trace_file = NULL;
+	my_buf = NULL;
+	pthread_mutex_unlock(&trace_lock);
+}
+
+#endif /* MM_TRACE */
+
@@ -6,6 +6,9 @@
 
 #include "string.h"
 #include "mm.h"
+#include "log.h"
+#include "mm-trace.h"
+#include "mm-tlb.h"
 #include <stdlib.h>
 #include <stdio.h>
 
@@ -16,16 +19,12 @@
  */
 int enlist_vm_freerg_list(struct mm_struct *mm, struct vm_rg_struct rg_elmt)
 {
-  struct vm_rg_struct *rg_node = mm->mmap->vm_freerg_list;
-
   if (rg_elmt.rg_start >= rg_elmt.rg_end)
     return -1;
 
-  if (rg_node != NULL)
-    rg_elmt.rg_next = rg_node;
-
-  /* Enlist the new region */
-  mm->mmap->vm_freerg_list = &rg_elmt;
+  /* Enlist a copy of the new region, owned by the list */
+  enlist_vm_rg_node(&mm->mmap->vm_freerg_list,
+                    init_vm_rg(rg_elmt.rg_start, rg_elmt.rg_end));
 
   return 0;
 }
@@ -104,7 +103,8 @@ int __alloc(struct pcb_t *caller, int vmaid, int rgid, int size, int *alloc_addr
   /* TODO INCREASE THE LIMIT
    * inc_vma_limit(caller, vmaid, inc_sz)
    */
-  inc_vma_limit(caller, vmaid, inc_sz);
+  if (inc_vma_limit(caller, vmaid, inc_sz) < 0)
+    return -1;
 
   /*Successful increase limit */
   caller->mm->symrgtbl[rgid].rg_start = old_sbrk;
@@ -173,51 +173,55 @@ int pgfree_data(struct pcb_t *proc, uint32_t reg_index)
  */
 int pg_getpage(struct mm_struct *mm, int pgn, int *fpn, struct pcb_t *caller)
 {
-  uint32_t pte = mm->pgd[pgn]; // page table entry for virtual page
+  if (tlb_lookup(caller->pid, pgn, fpn))
+    return 0;
 
-  if (!PAGING_PAGE_PRESENT(pte))
-  {
-    /* If the page is not present in physical memory */
+  uint32_t *ptep = pte_get(mm, pgn); // page table entry for virtual page
 
+  if (ptep == NULL || !PAGING_PAGE_PRESENT(*ptep))
+    return -1; /* Page was never mapped */
+
+  uint32_t pte = *ptep;
+
+  if (pte & PAGING_PTE_SWAPPED_MASK)
+  {
+    /* The page is in swap, bring it back to a frame of RAM */
+    int tgtfpn = GETVAL(pte, PAGING_PTE_SWPOFF_MASK, PAGING_PTE_SWPOFF_LOBIT);
     int ramfpn;
-    int tgtfpn = PAGING_SWP(pte); // determine the target swap frame number
-    /* Find a free frame in RAM */
-    if (MEMPHY_get_freefp(caller->mram, &ramfpn) == 0)
-    {
-      /* If found a free frame in RAM */
-      
 
-      pte_set_fpn(&mm->pgd[pgn], ramfpn);                                // set the page table entry to point to a free frame in RAM
-      __swap_cp_page(caller->active_mswp, tgtfpn, caller->mram, ramfpn); // copy the contents of the page from swap space into RAM
-    }
-    else
+    if (MEMPHY_get_freefp(caller->mram, &ramfpn) != 0)
     {
-      /* Unable to find a free frame in RAM, swap page out to swap space */
+      /* No free frame in RAM, swap a victim page out to free one */
       int vicpgn;
       int swpfpn;
 
-      /* Find victim page to be replaced */
-      find_victim_page(caller->mm, &vicpgn); // function call to find a victim page
-
-      MEMPHY_get_freefp(caller->active_mswp, &swpfpn); // get a free frame in swap space
-
-      /* Swap victim page out to swap space */
-      __swap_cp_page(caller->mram, vicpgn, caller->active_mswp, swpfpn);
-
-      /* Update page table entries for swapped-out page */
-      pte_set_swap(&mm->pgd[vicpgn], 0, swpfpn); // set the swap type to 0 (traditional swap space) and swap offset to swpfpn
+      /* Take the swap slot first, a victim taken off the FIFO list could
+       * not be evicted again */
+      if (MEMPHY_get_freefp(caller->active_mswp, &swpfpn) != 0)
+        return -1;
+      if (find_victim_page(mm, &vicpgn) != 0)
+      {
+        MEMPHY_put_freefp(caller->active_mswp, swpfpn);
+        return -1;
+      }
 
-      /* Swap new page in from swap space */
-      __swap_cp_page(caller->active_mswp, tgtfpn, caller->mram, vicpgn); // copy the contents of the page from swap space into RAM
+      uint32_t *vicpte = pte_get(mm, vicpgn);
+      ramfpn = GETVAL(*vicpte, PAGING_PTE_FPN_MASK, PAGING_PTE_FPN_LOBIT);
+      __swap_cp_page(caller->mram, ramfpn, caller->active_mswp, swpfpn);
+      pte_set_swap(vicpte, 0, swpfpn);
+      tlb_invalidate(caller->pid, vicpgn);
     }
 
+    /* Swap the page in and release its swap slot */
+    __swap_cp_page(caller->active_mswp, tgtfpn, caller->mram, ramfpn);
+    MEMPHY_put_freefp(caller->active_mswp, tgtfpn);
+    pte_set_fpn(ptep, ramfpn);
+
     enlist_pgn_node(&caller->mm->fifo_pgn, pgn); // add page to process's FIFO queue
   }
-  else
-  {
-    /* If the page is already present in physical memory */
-    *fpn = PAGING_FPN(pte); // get the physical frame number
-  }
+
+  *fpn = GETVAL(*ptep, PAGING_PTE_FPN_MASK, PAGING_PTE_FPN_LOBIT);
+  tlb_insert(caller->pid, pgn, *fpn);
 
   return 0;
 }
@@ -234,6 +238,7 @@ int pg_getval(struct mm_struct *mm, int addr, BYTE *data, struct pcb_t *caller)
   int off = PAGING_OFFST(addr);
   int fpn;
 
+  mm_trace(caller->pid, pgn, off, MM_TRACE_READ);
   /* Get the page to MEMRAM, swap from MEMSWAP if needed */
   if (pg_getpage(mm, pgn, &fpn, caller) != 0)
     return -1; /* invalid page access */
@@ -257,6 +262,7 @@ int pg_setval(struct mm_struct *mm, int addr, BYTE value, struct pcb_t *caller)
   int off = PAGING_OFFST(addr);
   int fpn;
 
+  mm_trace(caller->pid, pgn, off, MM_TRACE_WRITE);
   /* Get the page to MEMRAM, swap from MEMSWAP if needed */
   if (pg_getpage(mm, pgn, &fpn, caller) != 0)
     return -1; /* invalid page access */
@@ -302,7 +308,7 @@ int pgread(
 
   destination = (uint32_t)data;
 #ifdef IODUMP
-  printf("read region=%d offset=%d value=%d\n", source, offset, data);
+  log_printf("read region=%d offset=%d value=%d\n", source, offset, data);
 #ifdef PAGETBL_DUMP
   print_pgtbl(proc, 0, -1); // print max TBL
 #endif
@@ -342,7 +348,7 @@ int pgwrite(
     uint32_t offset)
 {
 #ifdef IODUMP
-  printf("write region=%d offset=%d value=%d\n", destination, offset, data);
+  log_printf("write region=%d offset=%d value=%d\n", destination, offset, data);
 #ifdef PAGETBL_DUMP
   print_pgtbl(proc, 0, -1); // print max TBL
 #endif
@@ -352,30 +358,272 @@ int pgwrite(
   return __write(proc, 0, destination, offset, data);
 }
 
-/*free_pcb_memphy - collect all memphy of pcb
+/*pg_getphy - get the MEMRAM address of a virtual address
+ *@caller: caller
+ *@addr: virtual address to acess
+ *
+ * The range from addr to the end of its page is contiguous in MEMRAM
+ */
+static int pg_getphy(struct pcb_t *caller, int addr)
+{
+  int fpn;
+
+  if (pg_getpage(caller->mm, PAGING_PGN(addr), &fpn, caller) != 0)
+    return -1;
+  return (fpn << PAGING_ADDR_FPN_LOBIT) + PAGING_OFFST(addr);
+}
+
+/* Bytes from addr to the end of its page */
+#define PAGING_PAGE_LEFT(addr) (PAGING_PAGESZ - PAGING_OFFST(addr))
+
+/*pg_getphy2 - get the MEMRAM addresses of two virtual addresses
+ *
+ * Bringing the second page in may swap the first one out, translate the
+ * first one again until both are in place
+ */
+static int pg_getphy2(struct pcb_t *caller, int a, int opa, int b, int opb,
+                      int *phya, int *phyb)
+{
+  int retry;
+
+  mm_trace(caller->pid, PAGING_PGN(a), PAGING_OFFST(a), opa);
+  mm_trace(caller->pid, PAGING_PGN(b), PAGING_OFFST(b), opb);
+  *phya = pg_getphy(caller, a);
+  for (retry = 0; retry < 2; retry++)
+  {
+    *phyb = pg_getphy(caller, b);
+    int again = pg_getphy(caller, a);
+    if (*phya < 0 || *phyb < 0 || again == *phya)
+      break;
+    *phya = again;
+  }
+  return (*phya < 0 || *phyb < 0) ? -1 : 0;
+}
+
+static struct vm_rg_struct *get_rg(struct pcb_t *caller, int vmaid, int rgid)
+{
+  if (get_vma_by_num(caller->mm, vmaid) == NULL)
+    return NULL;
+  return get_symrg_byid(caller->mm, rgid);
+}
+
+/*__copy - copy a range between two memory regions
+ *@caller: caller
+ *@vmaid: ID vm area of both regions
+ *@srcid, srcoff: source region ID and offset
+ *@dstid, dstoff: destination region ID and offset
+ *@size: number of bytes
+ *
+ * Pages are translated once per chunk, a chunk ends at the first page
+ * boundary of either range
+ */
+int __copy(struct pcb_t *caller, int vmaid, int srcid, int srcoff,
+           int dstid, int dstoff, int size)
+{
+  struct vm_rg_struct *src = get_rg(caller, vmaid, srcid);
+  struct vm_rg_struct *dst = get_rg(caller, vmaid, dstid);
+  int sphy, dphy;
+
+  if (src == NULL || dst == NULL) /* Invalid memory identify */
+    return -1;
+
+  int saddr = src->rg_start + srcoff;
+  int daddr = dst->rg_start + dstoff;
+  while (size > 0)
+  {
+    int chunk = size;
+    if (chunk > PAGING_PAGE_LEFT(saddr))
+      chunk = PAGING_PAGE_LEFT(saddr);
+    if (chunk > PAGING_PAGE_LEFT(daddr))
+      chunk = PAGING_PAGE_LEFT(daddr);
+
+    if (pg_getphy2(caller, saddr, MM_TRACE_READ, daddr, MM_TRACE_WRITE,
+                   &sphy, &dphy) != 0)
+      return -1;
+    MEMPHY_copy(caller->mram, dphy, sphy, chunk);
+
+    saddr += chunk;
+    daddr += chunk;
+    size -= chunk;
+  }
+  return 0;
+}
+
+/*__fill - set a range of a memory region to one value
  *@caller: caller
  *@vmaid: ID vm area to alloc memory region
- *@incpgnum: number of page
+ *@rgid: memory region ID (used to identify variable in symbole table)
+ *@offset: offset to acess in memory region
+ *@size: number of bytes
+ *@value: value
+ */
+int __fill(struct pcb_t *caller, int vmaid, int rgid, int offset, int size, BYTE value)
+{
+  struct vm_rg_struct *currg = get_rg(caller, vmaid, rgid);
+
+  if (currg == NULL) /* Invalid memory identify */
+    return -1;
+
+  int addr = currg->rg_start + offset;
+  while (size > 0)
+  {
+    int chunk = (size < PAGING_PAGE_LEFT(addr)) ? size : PAGING_PAGE_LEFT(addr);
+    mm_trace(caller->pid, PAGING_PGN(addr), PAGING_OFFST(addr), MM_TRACE_WRITE);
+    int phy = pg_getphy(caller, addr);
+    if (phy < 0)
+      return -1;
+    MEMPHY_fill(caller->mram, phy, value, chunk);
+
+    addr += chunk;
+    size -= chunk;
+  }
+  return 0;
+}
+
+/*__compare - compare ranges of two memory regions
+ *@caller: caller
+ *@vmaid: ID vm area of both regions
+ *@aid, aoff: first region ID and offset
+ *@bid, boff: second region ID and offset
+ *@size: number of bytes
+ *@result: <0, 0 or >0 as memcmp
+ */
+int __compare(struct pcb_t *caller, int vmaid, int aid, int aoff,
+              int bid, int boff, int size, int *result)
+{
+  struct vm_rg_struct *a = get_rg(caller, vmaid, aid);
+  struct vm_rg_struct *b = get_rg(caller, vmaid, bid);
+  int aphy, bphy;
+
+  if (a == NULL || b == NULL) /* Invalid memory identify */
+    return -1;
+
+  int aaddr = a->rg_start + aoff;
+  int baddr = b->rg_start + boff;
+  *result = 0;
+  while (size > 0 && *result == 0)
+  {
+    int chunk = size;
+    if (chunk > PAGING_PAGE_LEFT(aaddr))
+      chunk = PAGING_PAGE_LEFT(aaddr);
+    if (chunk > PAGING_PAGE_LEFT(baddr))
+      chunk = PAGING_PAGE_LEFT(baddr);
+
+    if (pg_getphy2(caller, aaddr, MM_TRACE_READ, baddr, MM_TRACE_READ,
+                   &aphy, &bphy) != 0)
+      return -1;
+    MEMPHY_compare(caller->mram, aphy, bphy, chunk, result);
+
+    aaddr += chunk;
+    baddr += chunk;
+    size -= chunk;
+  }
+  return 0;
+}
+
+/*pgcopy - PAGING-based copy between regions */
+int pgcopy(
+    struct pcb_t *proc, // Process executing the instruction
+    uint32_t source,    // Index of source register
+    uint32_t srcoff,    // Source address = [source] + [srcoff]
+    uint32_t destination, // Index of destination register
+    uint32_t dstoff,    // Destination address = [destination] + [dstoff]
+    uint32_t size)
+{
+  int val = __copy(proc, 0, source, srcoff, destination, dstoff, size);
+#ifdef IODUMP
+  log_printf("copy region=%d offset=%d region=%d offset=%d size=%d\n",
+             source, srcoff, destination, dstoff, size);
+#ifdef PAGETBL_DUMP
+  print_pgtbl(proc, 0, -1); // print max TBL
+#endif
+  MEMPHY_dump(proc->mram);
+#endif
+
+  return val;
+}
+
+/*pgfill - PAGING-based fill of a region */
+int pgfill(
+    struct pcb_t *proc,   // Process executing the instruction
+    uint32_t destination, // Index of destination register
+    uint32_t offset,      // Destination address = [destination] + [offset]
+    uint32_t size,
+    BYTE data)
+{
+  int val = __fill(proc, 0, destination, offset, size, data);
+#ifdef IODUMP
+  log_printf("fill region=%d offset=%d size=%d value=%d\n",
+             destination, offset, size, data);
+#ifdef PAGETBL_DUMP
+  print_pgtbl(proc, 0, -1); // print max TBL
+#endif
+  MEMPHY_dump(proc->mram);
+#endif
+
+  return val;
+}
+
+/*pgcompare - PAGING-based compare of regions */
+int pgcompare(
+    struct pcb_t *proc, // Process executing the instruction
+    uint32_t first,     // Index of the first register
+    uint32_t firstoff,  // First address = [first] + [firstoff]
+    uint32_t second,    // Index of the second register
+    uint32_t secondoff, // Second address = [second] + [secondoff]
+    uint32_t size)
+{
+  int result = 0;
+  int val = __compare(proc, 0, first, firstoff, second, secondoff, size, &result);
+#ifdef IODUMP
+  log_printf("compare region=%d offset=%d region=%d offset=%d size=%d result=%d\n",
+             first, firstoff, second, secondoff, size,
+             (result > 0) - (result < 0));
+#endif
+
+  return val;
+}
+
+/*free_pcb_memphy - collect all memphy of pcb, the frames of its pages in
+ *RAM and the swap slots of its swapped pages
+ *@caller: caller
  */
 int free_pcb_memph(struct pcb_t *caller)
 {
-  int pagenum, fpn;
-  uint32_t pte;
+  int pagenum, fpn, swptyp;
+  uint32_t *ptbl, pte;
+  struct mm_struct *mm = caller->mm;
+
+  if (mm->pgd == NULL)
+    return 0;
 
+  /* Walk the leaf tables which exist, the others map nothing */
   for (pagenum = 0; pagenum < PAGING_MAX_PGN; pagenum++)
   {
-    pte = caller->mm->pgd[pagenum];
+    if ((ptbl = mm->pgd[PAGING_PGD_IDX(pagenum)]) == NULL)
+    {
+      pagenum |= PAGING_PTBL_SZ - 1;
+      continue;
+    }
+    pte = ptbl[PAGING_PTBL_IDX(pagenum)];
 
     if (!PAGING_PAGE_PRESENT(pte))
+      continue;
+
+    if (pte & PAGING_PTE_SWAPPED_MASK)
     {
-      fpn = PAGING_FPN(pte);
-      MEMPHY_put_freefp(caller->mram, fpn);
+      /* mswp points to the array of swap devices */
+      swptyp = GETVAL(pte, PAGING_PTE_SWPTYP_MASK, PAGING_PTE_SWPTYP_LOBIT);
+      fpn = GETVAL(pte, PAGING_PTE_SWPOFF_MASK, PAGING_PTE_SWPOFF_LOBIT);
+      MEMPHY_put_freefp((struct memphy_struct *)caller->mswp + swptyp, fpn);
     }
     else
     {
-      fpn = PAGING_SWP(pte);
-      MEMPHY_put_freefp(caller->active_mswp, fpn);
+      fpn = GETVAL(pte, PAGING_PTE_FPN_MASK, PAGING_PTE_FPN_LOBIT);
+      MEMPHY_put_freefp(caller->mram, fpn);
     }
+    ptbl[PAGING_PTBL_IDX(pagenum)] = 0;
+    tlb_invalidate(caller->pid, pagenum);
   }
 
   return 0;
@@ -426,7 +674,7 @@ int validate_overlap_vm_area(struct pcb_t *caller, int vmaid, int vmastart, int
  */
 int inc_vma_limit(struct pcb_t *caller, int vmaid, int inc_sz)
 {
-  struct vm_rg_struct *newrg = malloc(sizeof(struct vm_rg_struct));
+  struct vm_rg_struct newrg;
   int inc_amt = PAGING_PAGE_ALIGNSZ(inc_sz);
   int incnumpage = inc_amt / PAGING_PAGESZ;
   struct vm_rg_struct *area = get_vm_area_node_at_brk(caller, vmaid, inc_sz, inc_amt);
@@ -436,15 +684,23 @@ int inc_vma_limit(struct pcb_t *caller, int vmaid, int inc_sz)
 
   /*Validate overlap of obtained region */
   if (validate_overlap_vm_area(caller, vmaid, area->rg_start, area->rg_end) < 0)
+  {
+    free(area);
     return -1; /*Overlap and failed allocation */
+  }
 
   /* The obtained vm area (only)
-   * now will be alloc real ram region */
-  cur_vma->vm_end += inc_sz;
+   * now will be alloc real ram region, all its pages in one pass */
   if (vm_map_ram(caller, area->rg_start, area->rg_end,
-                 old_end, incnumpage, newrg) < 0)
+                 old_end, incnumpage, &newrg) < 0)
+  {
+    free(area);
     return -1; /* Map the memory to MEMRAM */
+  }
+  cur_vma->vm_end += inc_amt;
+  cur_vma->sbrk += inc_amt;
 
+  free(area);
   return 0;
 }
 
@@ -458,32 +714,21 @@ int inc_vma_limit(struct pcb_t *caller, int vmaid, int inc_sz)
 
 int find_victim_page(struct mm_struct *mm, int *retpgn)
 {
-  // Get a pointer to the first (oldest) page in the FIFO list in the process's struct
-  struct pgn_t *pg = mm->fifo_pgn;
+  // Get a pointer to the first (newest) page in the FIFO list in the process's struct
+  struct pgn_t **link = &mm->fifo_pgn;
 
   // If the FIFO list is empty, return error (-1)
-  if (pg == NULL)
-  {
+  if (*link == NULL)
     return -1;
-  }
 
   // Traverse through the FIFO list to get the last node, which is the oldest page
-  int i = 1;
-  while (pg->pg_next != NULL)
-  {
-    pg = pg->pg_next;
-    i++;
-  }
-
-  // If there was only one page in the list, set the FIFO list to null
-  if (i == 1)
-  {
-    mm->fifo_pgn = NULL;
-  }
+  while ((*link)->pg_next != NULL)
+    link = &(*link)->pg_next;
 
-  // Set the return value to the ID of the oldest page.
-  // This ID will be stored in the integer variable passed as an argument.
+  // Set the return value to the ID of the oldest page and unlink it
+  struct pgn_t *pg = *link;
   *retpgn = pg->pgn;
+  *link = NULL;
 
   // Free the memory allocated for the oldest page
   free(pg);
@@ -544,6 +789,7 @@ int get_free_vmrg_area(struct pcb_t *caller, int vmaid, int size, struct vm_rg_s
           rgit->rg_next = NULL;
         }
       }
+      break;
     }
     else
     {
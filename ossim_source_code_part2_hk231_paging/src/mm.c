@@ -5,8 +5,11 @@
  */
 
 #include "mm.h"
+#include "log.h"
+#include "mm-tlb.h"
 #include <stdlib.h>
 #include <stdio.h>
+#include <string.h>
 
 /*
  * init_pte - Initialize PTE entry
@@ -43,6 +46,58 @@ int init_pte(uint32_t *pte,
   return 0;
 }
 
+/*
+ * pte_get - get the PTE of a page
+ * @mm  : memory management instance
+ * @pgn : page number
+ * Return NULL when no page of its leaf table was ever mapped
+ */
+uint32_t *pte_get(struct mm_struct *mm, int pgn)
+{
+  uint32_t *ptbl;
+
+  if (mm->pgd == NULL || pgn < 0 || pgn >= PAGING_MAX_PGN)
+    return NULL;
+  if ((ptbl = mm->pgd[PAGING_PGD_IDX(pgn)]) == NULL)
+    return NULL;
+  return &ptbl[PAGING_PTBL_IDX(pgn)];
+}
+
+/*
+ * pte_alloc - get the PTE of a page, allocating its tables if needed
+ * @mm  : memory management instance
+ * @pgn : page number
+ */
+uint32_t *pte_alloc(struct mm_struct *mm, int pgn)
+{
+  uint32_t **dir;
+
+  if (pgn < 0 || pgn >= PAGING_MAX_PGN)
+    return NULL;
+  if (mm->pgd == NULL)
+    mm->pgd = calloc(PAGING_PGD_SZ, sizeof(uint32_t *));
+  dir = &mm->pgd[PAGING_PGD_IDX(pgn)];
+  if (*dir == NULL)
+    *dir = calloc(PAGING_PTBL_SZ, sizeof(uint32_t));
+  return &(*dir)[PAGING_PTBL_IDX(pgn)];
+}
+
+/*
+ * pgtbl_free - free the page directory and its leaf tables
+ * @mm : memory management instance
+ */
+void pgtbl_free(struct mm_struct *mm)
+{
+  int i;
+
+  if (mm->pgd == NULL)
+    return;
+  for (i = 0; i < PAGING_PGD_SZ; i++)
+    free(mm->pgd[i]);
+  free(mm->pgd);
+  mm->pgd = NULL;
+}
+
 /*
  * pte_set_swap - Set PTE entry for swapped page
  * @pte    : target page table entry (PTE)
@@ -82,37 +137,42 @@ int pte_set_fpn(uint32_t *pte, int fpn)
 int vmap_page_range(struct pcb_t *caller, // process call
                                 int addr, // start address which is aligned to pagesz
                                int pgnum, // num of mapping page
-           struct framephy_struct *frames,// list of the mapped frames
-              struct vm_rg_struct *ret_rg)// return mapped region, the real mapped fp
-{                                         // no guarantee all given pages are mapped
+                         int *frames, // exactly pgnum frames
+              struct vm_rg_struct *ret_rg)// return mapped region
+{
   uint32_t * pte;
-  struct framephy_struct *fpit;
-  //int  fpn;
-  int pgit = 0;
+  int pgit;
   int pgn = PAGING_PGN(addr);
 
   ret_rg->rg_end = ret_rg->rg_start = addr; // at least the very first space is usable
-  // add new mapped frame to the front of frames
-  fpit = frames;
-  frames = fpit;
-  /* TODO map range of frame to address space
-   *      [addr to addr + pgnum*PAGING_PAGESZ
-   *      in page table caller->mm->pgd[]
+  if (pgnum <= 0)
+    return 0;
+
+  /* Map the frames in order on consecutive pages
+   * [addr to addr + pgnum*PAGING_PAGESZ]
    */
-  // whether reach the number of required mapped page
-  //  or fill all the mapped frames
-  while (fpit != NULL && pgit < pgnum) {
-    pte = caller->mm->pgd;
-    pte_set_fpn(pte, fpit->fpn);
-    fpit = fpit->fp_next;
-    pgit++;
+  for (pgit = 0; pgit < pgnum; pgit++)
+  {
+    if ((pte = pte_alloc(caller->mm, pgn + pgit)) == NULL)
+      break;
+    pte_set_fpn(pte, frames[pgit]);
+    tlb_invalidate(caller->pid, pgn + pgit);
   }
-  ret_rg->rg_end = addr + pgit * PAGING_PAGESZ;
-  
-   /* Tracking for later page replacement activities (if needed)
-    * Enqueue new usage page */
-   enlist_pgn_node(&caller->mm->fifo_pgn, pgn+pgit);
 
+  if (pgit < pgnum) {
+    /* Unmap what was mapped, the caller still owns the frames */
+    while (pgit-- > 0) {
+      *pte_get(caller->mm, pgn + pgit) = 0;
+      tlb_invalidate(caller->pid, pgn + pgit);
+    }
+    return -1;
+  }
+  ret_rg->rg_end = addr + pgnum * PAGING_PAGESZ;
+
+  /* Tracking for later page replacement activities, every new page is
+   * enqueued, the first one ends up the oldest */
+  for (pgit = 0; pgit < pgnum; pgit++)
+    enlist_pgn_node(&caller->mm->fifo_pgn, pgn + pgit);
 
   return 0;
 }
@@ -121,27 +181,14 @@ int vmap_page_range(struct pcb_t *caller, // process call
  * alloc_pages_range - allocate req_pgnum of frame in ram
  * @caller    : caller
  * @req_pgnum : request page num
- * @frm_lst   : frame list
+ * @frames    : returned frames, room for req_pgnum
  */
 
-int alloc_pages_range(struct pcb_t *caller, int req_pgnum, struct framephy_struct** frm_lst)
+int alloc_pages_range(struct pcb_t *caller, int req_pgnum, int *frames)
 {
-  int pgit, fpn;
-  struct framephy_struct *newfp_str, *usedfp_str;
-
-  for(pgit = 0; pgit < req_pgnum; pgit++)
-  {
-    if(MEMPHY_get_freefp(caller->mram, &fpn) == 0)
-   {
-    // Assign fpn to frm_list
-    MEMPHY_put_freefp(frm_lst, fpn);
-    // Move the frame to used_list of caller
-    MEMPHY_put_freefp(caller->mram->used_fp_list, fpn);
-   } else {  // ERROR CODE of obtaining somes but not enough frames
-    printf("[ERROR] Only got %d frames. Aborting...\n", pgit);
-    return -1;
-   }
- }
+  /* All the frames in one operation, or none */
+  if (MEMPHY_get_freefp_range(caller->mram, req_pgnum, frames) != 0)
+    return -3000; /* Out of memory */
 
   return 0;
 }
@@ -158,9 +205,13 @@ int alloc_pages_range(struct pcb_t *caller, int req_pgnum, struct framephy_struc
  */
 int vm_map_ram(struct pcb_t *caller, int astart, int aend, int mapstart, int incpgnum, struct vm_rg_struct *ret_rg)
 {
-  struct framephy_struct *frm_lst = NULL;
+  int *frm_lst;
   int ret_alloc;
 
+  if (incpgnum <= 0)
+    return vmap_page_range(caller, mapstart, 0, NULL, ret_rg);
+  frm_lst = malloc(incpgnum * sizeof(int));
+
   /*@bksysnet: author provides a feasible solution of getting frames
    *FATAL logic in here, wrong behaviour if we have not enough page
    *i.e. we request 1000 frames meanwhile our RAM has size of 3 frames
@@ -168,10 +219,12 @@ int vm_map_ram(struct pcb_t *caller, int astart, int aend, int mapstart, int inc
    *in endless procedure of swap-off to get frame and we have not provide
    *duplicate control mechanism, keep it simple
    */
-  ret_alloc = alloc_pages_range(caller, incpgnum, &frm_lst);
+  ret_alloc = alloc_pages_range(caller, incpgnum, frm_lst);
 
-  if (ret_alloc < 0 && ret_alloc != -3000)
+  if (ret_alloc < 0 && ret_alloc != -3000) {
+    free(frm_lst);
     return -1;
+  }
 
   /* Out of memory */
   if (ret_alloc == -3000)
@@ -179,13 +232,20 @@ int vm_map_ram(struct pcb_t *caller, int astart, int aend, int mapstart, int inc
 #ifdef MMDBG
      printf("OOM: vm_map_ram out of memory \n");
 #endif
+     free(frm_lst);
      return -1;
   }
 
   /* it leaves the case of memory is enough but half in ram, half in swap
    * do the swaping all to swapper to get the all in ram */
-  vmap_page_range(caller, mapstart, incpgnum, frm_lst, ret_rg);
+  if (vmap_page_range(caller, mapstart, incpgnum, frm_lst, ret_rg) < 0)
+  {
+    MEMPHY_put_freefp_range(caller->mram, incpgnum, frm_lst);
+    free(frm_lst);
+    return -1;
+  }
 
+  free(frm_lst);
   return 0;
 }
 
@@ -222,13 +282,16 @@ int init_mm(struct mm_struct *mm, struct pcb_t *caller)
 {
   struct vm_area_struct * vma = malloc(sizeof(struct vm_area_struct));
 
-  mm->pgd = malloc(PAGING_MAX_PGN*sizeof(uint32_t));
+  mm->pgd = NULL; /* Allocated with the first mapped page */
+  memset(mm->symrgtbl, 0, sizeof(mm->symrgtbl));
+  mm->fifo_pgn = NULL;
 
   /* By default the owner comes with at least one vma */
   vma->vm_id = 1;
   vma->vm_start = 0;
   vma->vm_end = vma->vm_start;
   vma->sbrk = vma->vm_start;
+  vma->vm_freerg_list = NULL;
   struct vm_rg_struct *first_rg = init_vm_rg(vma->vm_start, vma->vm_end);
   enlist_vm_rg_node(&vma->vm_freerg_list, first_rg);
 
@@ -240,6 +303,42 @@ int init_mm(struct mm_struct *mm, struct pcb_t *caller)
   return 0;
 }
 
+/*
+ * free_mm - release all a Memory Management instance holds: the frames of
+ * its pages in RAM, the swap slots of its swapped pages, its vm areas,
+ * free regions and page list. The mm is left empty
+ * @mm:     self mm
+ * @caller: mm owner
+ */
+int free_mm(struct mm_struct *mm, struct pcb_t *caller)
+{
+  struct vm_area_struct *vma;
+  struct vm_rg_struct *rg;
+  struct pgn_t *pg;
+
+  if (mm->pgd != NULL) {
+    free_pcb_memph(caller);
+    pgtbl_free(mm);
+  }
+
+  while ((vma = mm->mmap) != NULL) {
+    mm->mmap = vma->vm_next;
+    while ((rg = vma->vm_freerg_list) != NULL) {
+      vma->vm_freerg_list = rg->rg_next;
+      free(rg);
+    }
+    free(vma);
+  }
+
+  while ((pg = mm->fifo_pgn) != NULL) {
+    mm->fifo_pgn = pg->pg_next;
+    free(pg);
+  }
+
+  memset(mm, 0, sizeof(struct mm_struct));
+  return 0;
+}
+
 struct vm_rg_struct* init_vm_rg(int rg_start, int rg_end)
 {
   struct vm_rg_struct *rgnode = malloc(sizeof(struct vm_rg_struct));
@@ -332,6 +431,14 @@ int print_list_pgn(struct pgn_t *ip)
    return 0;
 }
 
+/* Value of the PTE of [pgn], 0 if its page table was never allocated */
+static inline uint32_t pte_value(struct mm_struct *mm, int pgn)
+{
+  uint32_t *pte = pte_get(mm, pgn);
+
+  return pte ? *pte : 0;
+}
+
 int print_pgtbl(struct pcb_t *caller, uint32_t start, uint32_t end)
 {
   int pgn_start,pgn_end;
@@ -345,14 +452,15 @@ int print_pgtbl(struct pcb_t *caller, uint32_t start, uint32_t end)
   pgn_start = PAGING_PGN(start);
   pgn_end = PAGING_PGN(end);
 
-  printf("print_pgtbl: %d - %d", start, end);
-  if (caller == NULL) {printf("NULL caller\n"); return -1;}
-    printf("\n");
+  log_printf("print_pgtbl: %d - %d", start, end);
+  if (caller == NULL) {log_printf("NULL caller\n"); return -1;}
+    log_printf("\n");
 
 
   for(pgit = pgn_start; pgit < pgn_end; pgit++)
   {
-     printf("%08ld: %08x\n", pgit * sizeof(uint32_t), caller->mm->pgd[pgit]);
+     log_printf("%08ld: %08x\n", pgit * sizeof(uint32_t),
+                pte_value(caller->mm, pgit));
   }
 
   return 0;
@@ -0,0 +1,281 @@
+
+/*
+ * Offline page replacement replay
+ * Runs a trace recorded with MM_TRACE through page replacement policies
+ * for a range of MEMRAM sizes, without the scheduler or any thread.
+ * Every process page is a distinct page, all processes share the frames.
+ * Usage: mmreplay [-p fifo,lru,clock,opt] [-f frames,...] [-m bytes,...]
+ *                 [trace]
+ * Sizes of -m take a K or M suffix, e.g. -m 1K,4K. Without -f or -m, the
+ * frame count goes from 1 by powers of two up to the number of pages.
+ */
+
+#include "mm-trace.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#define REPLAY_MAX_SIZES	64
+
+enum { POL_FIFO, POL_LRU, POL_CLOCK, POL_OPT, NR_POLICIES };
+
+static const char * pol_names[NR_POLICIES] = { "fifo", "lru", "clock", "opt" };
+
+struct replay {
+	size_t n;		// Accesses
+	uint32_t * page;	// Dense page id of each access
+	uint8_t * write;	// Access is a write
+	size_t * next_use;	// Next access to the same page, n if none
+	uint32_t npages;
+	uint32_t page_size;
+};
+
+struct replay_stat {
+	size_t faults;
+	size_t writebacks;	// Dirty pages evicted
+};
+
+static int cmp_u64(const void * a, const void * b) {
+	uint64_t x = *(const uint64_t *)a, y = *(const uint64_t *)b;
+	return (x > y) - (x < y);
+}
+
+/* Open addressing map from (pid, pgn) to a dense page id */
+struct page_map {
+	uint64_t * key;
+	uint32_t * id;
+	size_t mask;
+};
+
+static uint32_t page_id(struct page_map * map, uint64_t key, uint32_t * npages) {
+	size_t i = (key * 0x9e3779b97f4a7c15UL >> 20) & map->mask;
+	while (map->key[i] != 0 && map->key[i] != key)
+		i = (i + 1) & map->mask;
+	if (map->key[i] == 0) {
+		map->key[i] = key;
+		map->id[i] = (*npages)++;
+	}
+	return map->id[i];
+}
+
+static int load_trace(const char * path, struct replay * rp) {
+	struct mm_trace_hdr hdr;
+	FILE * file;
+	size_t i, size;
+
+	if ((file = fopen(path, "rb")) == NULL
+			|| fread(&hdr, sizeof(hdr), 1, file) != 1
+			|| hdr.magic != MM_TRACE_MAGIC
+			|| hdr.version != MM_TRACE_VERSION
+			|| hdr.rec_size != sizeof(struct mm_trace_rec)) {
+		printf("Cannot read trace %s\n", path);
+		return -1;
+	}
+	fseek(file, 0, SEEK_END);
+	size = (ftell(file) - sizeof(hdr)) / sizeof(struct mm_trace_rec);
+	fseek(file, sizeof(hdr), SEEK_SET);
+
+	struct mm_trace_rec * rec = malloc(size * sizeof(*rec) + 1);
+	size = fread(rec, sizeof(*rec), size, file);
+	fclose(file);
+
+	/* Put records in slot order, records of a slot keep their order */
+	uint64_t * order = malloc(size * sizeof(uint64_t) + 1);
+	for (i = 0; i < size; i++)
+		order[i] = ((uint64_t)rec[i].slot << 32) | i;
+	qsort(order, size, sizeof(uint64_t), cmp_u64);
+
+	struct page_map map;
+	for (map.mask = 1; map.mask < 2 * size; map.mask <<= 1)
+		;
+	map.key = calloc(map.mask, sizeof(uint64_t));
+	map.id = malloc(map.mask * sizeof(uint32_t));
+	map.mask--;
+
+	rp->n = size;
+	rp->page_size = hdr.page_size;
+	rp->page = malloc(size * sizeof(uint32_t) + 1);
+	rp->write = malloc(size + 1);
+	rp->next_use = malloc(size * sizeof(size_t) + 1);
+	rp->npages = 0;
+	for (i = 0; i < size; i++) {
+		struct mm_trace_rec * r = &rec[order[i] & 0xffffffffUL];
+		/* pid is never 0, the key is never the empty key */
+		uint64_t key = ((uint64_t)r->pid << 32) | r->pgn;
+		rp->page[i] = page_id(&map, key, &rp->npages);
+		rp->write[i] = (r->op == MM_TRACE_WRITE);
+	}
+
+	/* Next use of every access, for the optimal policy */
+	size_t * last = malloc(rp->npages * sizeof(size_t) + 1);
+	for (i = 0; i < rp->npages; i++)
+		last[i] = size;
+	for (i = size; i-- > 0; ) {
+		rp->next_use[i] = last[rp->page[i]];
+		last[rp->page[i]] = i;
+	}
+
+	free(last);
+	free(map.key);
+	free(map.id);
+	free(order);
+	free(rec);
+	return 0;
+}
+
+static struct replay_stat replay_run(struct replay * rp, int policy, int frames) {
+	struct replay_stat st = { 0, 0 };
+	int32_t * page_frame = malloc(rp->npages * sizeof(int32_t) + 1);
+	uint32_t * frame_page = malloc(frames * sizeof(uint32_t));
+	size_t * stamp = malloc(frames * sizeof(size_t)); // Last use, next use
+	uint8_t * ref = calloc(frames, 1);
+	uint8_t * dirty = calloc(frames, 1);
+	int used = 0, hand = 0, f, j;
+	size_t i;
+
+	for (i = 0; i < rp->npages; i++)
+		page_frame[i] = -1;
+
+	for (i = 0; i < rp->n; i++) {
+		uint32_t page = rp->page[i];
+		f = page_frame[page];
+		if (f < 0) {
+			st.faults++;
+			if (used < frames) {
+				f = used++;
+			} else {
+				switch (policy) {
+				case POL_FIFO:
+					f = hand;
+					hand = (hand + 1) % frames;
+					break;
+				case POL_LRU:
+					for (f = 0, j = 1; j < frames; j++)
+						if (stamp[j] < stamp[f])
+							f = j;
+					break;
+				case POL_CLOCK:
+					while (ref[hand]) {
+						ref[hand] = 0;
+						hand = (hand + 1) % frames;
+					}
+					f = hand;
+					hand = (hand + 1) % frames;
+					break;
+				default: /* POL_OPT */
+					for (f = 0, j = 1; j < frames; j++)
+						if (stamp[j] > stamp[f])
+							f = j;
+				}
+				if (dirty[f])
+					st.writebacks++;
+				page_frame[frame_page[f]] = -1;
+			}
+			page_frame[page] = f;
+			frame_page[f] = page;
+			dirty[f] = 0;
+		}
+		stamp[f] = (policy == POL_OPT) ? rp->next_use[i] : i;
+		ref[f] = 1;
+		dirty[f] |= rp->write[i];
+	}
+
+	free(page_frame);
+	free(frame_page);
+	free(stamp);
+	free(ref);
+	free(dirty);
+	return st;
+}
+
+static int parse_list(char * arg, int * out, int unit) {
+	char * tok, * end;
+	int n = 0;
+	for (tok = strtok(arg, ","); tok != NULL && n < REPLAY_MAX_SIZES;
+			tok = strtok(NULL, ",")) {
+		long val = strtol(tok, &end, 0);
+		if (*end == 'K' || *end == 'k')
+			val <<= 10;
+		else if (*end == 'M' || *end == 'm')
+			val <<= 20;
+		out[n++] = (int)(val / unit);
+	}
+	return n;
+}
+
+int main(int argc, char * argv[]) {
+	struct replay rp;
+	int policies[NR_POLICIES], nr_policies = 0;
+	int frames[REPLAY_MAX_SIZES], nr_frames = 0;
+	char * mem_arg = NULL;
+	int opt, i, p;
+
+	while ((opt = getopt(argc, argv, "p:f:m:")) != -1) {
+		switch (opt) {
+		case 'p': {
+			char * tok;
+			for (tok = strtok(optarg, ","); tok != NULL;
+					tok = strtok(NULL, ",")) {
+				for (p = 0; p < NR_POLICIES; p++)
+					if (!strcmp(tok, pol_names[p]))
+						break;
+				if (p == NR_POLICIES || nr_policies == NR_POLICIES) {
+					printf("Unknown policy %s\n", tok);
+					return 1;
+				}
+				policies[nr_policies++] = p;
+			}
+			break;
+		}
+		case 'f': nr_frames = parse_list(optarg, frames, 1); break;
+		case 'm': mem_arg = optarg; break;
+		default:
+			printf("Usage: mmreplay [-p fifo,lru,clock,opt] "
+				"[-f frames,...] [-m bytes,...] [trace]\n");
+			return 1;
+		}
+	}
+
+	if (load_trace((optind < argc) ? argv[optind] : "mm.trace", &rp) != 0)
+		return 1;
+	if (mem_arg != NULL)
+		nr_frames = parse_list(mem_arg, frames, rp.page_size);
+	if (nr_frames == 0)
+		for (i = 1; nr_frames < REPLAY_MAX_SIZES; i *= 2) {
+			frames[nr_frames++] = i;
+			if (i >= (int)rp.npages)
+				break;
+		}
+	if (nr_policies == 0)
+		for (p = 0; p < NR_POLICIES; p++)
+			policies[nr_policies++] = p;
+
+	printf("%zu accesses, %u pages of %u bytes\n",
+		rp.n, rp.npages, rp.page_size);
+	printf("%-8s %-6s %12s %8s %12s %10s\n",
+		"frames", "policy", "faults", "fault%", "writebacks", "ms");
+	for (i = 0; i < nr_frames; i++) {
+		if (frames[i] <= 0)
+			continue;
+		for (p = 0; p < nr_policies; p++) {
+			struct timespec t0, t1;
+			clock_gettime(CLOCK_MONOTONIC, &t0);
+			struct replay_stat st = replay_run(&rp, policies[p], frames[i]);
+			clock_gettime(CLOCK_MONOTONIC, &t1);
+			printf("%-8d %-6s %12zu %7.2f%% %12zu %10.2f\n",
+				frames[i], pol_names[policies[p]], st.faults,
+				rp.n ? 100.0 * st.faults / rp.n : 0.0,
+				st.writebacks,
+				(t1.tv_sec - t0.tv_sec) * 1e3
+					+ (t1.tv_nsec - t0.tv_nsec) / 1e6);
+		}
+	}
+
+	free(rp.page);
+	free(rp.write);
+	free(rp.next_use);
+	return 0;
+}
+
@@ -4,6 +4,11 @@
 #include "sched.h"
 #include "loader.h"
 #include "mm.h"
+#include "log.h"
+#include "affinity.h"
+#include "stats.h"
+#include "mm-trace.h"
+#include "mm-tlb.h"
 
 #include <pthread.h>
 #include <stdio.h>
@@ -27,116 +32,349 @@ struct mmpaging_ld_args {
 };
 #endif
 
-static struct ld_args{
-	char ** path;
-	unsigned long * start_time;
-#ifdef MLQ_SCHED
-	unsigned long * prio;
-#endif
-} ld_processes; // Array of processes
+/* A program of the configuration. Every arrival of a program shares its
+ * interned path and its code */
+struct ld_prog {
+	char * path;
+	struct code_seg_t * code; // Read ahead by ld_prefetch
+	struct ld_prog * next;
+};
+
+#define LD_PROG_BUCKETS	1024
+
+static struct ld_prog * ld_progs[LD_PROG_BUCKETS];
+static struct ld_prog ** ld_prog_list = NULL; // Programs in order of interning
+static int nr_progs = 0;
+
+/* The arrivals are read from the configuration while the simulation runs,
+ * only the next one is kept in memory */
+static struct ld_stream {
+	FILE * file;
+	char * line;	// getline buffer
+	size_t line_len;
+	int nr_left;	// Arrivals still to read
+	int has_next;
+	unsigned long start_time;
+	unsigned long prio;
+	struct ld_prog * prog;
+} ld_stream;
 int num_processes;
 
 struct cpu_args {
 	struct timer_id_t * timer_id;
 	int id;
+	/* State of the CPU kept from one slot to the next */
+	int time_left;
+	struct pcb_t * proc;
 };
 
+/* Outcome of one time slot of a CPU or of the loader */
+enum step_stat {
+	STEP_BUSY,	// Did some work and may do more next slot
+	STEP_IDLE,	// Has nothing to do before some other device acts
+	STEP_STOPPED	// Has finished for good
+};
+
+#ifndef LD_WORKERS
+#define LD_WORKERS 4
+#endif
+
+/* cpu_step - run one time slot of CPU [cpu] */
+static enum step_stat cpu_step(struct cpu_args * cpu) {
+	int id = cpu->id;
+	struct pcb_t * proc = cpu->proc;
+
+	/* Check the status of current process */
+	if (proc == NULL) {
+		/* No process is running, the we load new process from
+	 	* ready queue */
+		proc = get_proc(id);
+	}else if (proc->pc == proc->code->size) {
+		/* The porcess has finish it job */
+		log_printf("\tCPU %d: Processed %2d has finished\n",
+			id ,proc->pid);
+		stats_finish(proc);
+		free_proc(proc);
+		proc = get_proc(id);
+		cpu->time_left = 0;
+	}else if (cpu->time_left == 0) {
+		/* The process has done its job in current time slot */
+		log_printf("\tCPU %d: Put process %2d to run queue\n",
+			id, proc->pid);
+		put_proc(id, proc);
+		proc = get_proc(id);
+	}
+	cpu->proc = proc;
+
+	/* Recheck process status after loading new process */
+	if (proc == NULL && done) {
+		/* No process to run, exit */
+		log_printf("\tCPU %d stopped\n", id);
+		return STEP_STOPPED;
+	}else if (proc == NULL) {
+		/* There may be new processes to run in
+		 * next time slots, just skip current slot */
+		return STEP_IDLE;
+	}else if (cpu->time_left == 0) {
+		log_printf("\tCPU %d: Dispatched process %2d\n",
+			id, proc->pid);
+		cpu->time_left = time_slot;
+	}
+
+	/* Run current process */
+	tlb_set_cpu(id);
+	run_slice(proc, CPU_IPC);
+	tick_proc(proc);
+	stats_busy(id);
+	cpu->time_left--;
+	return STEP_BUSY;
+}
 
+#ifndef SIM_LOCKSTEP
 static void * cpu_routine(void * args) {
-	struct timer_id_t * timer_id = ((struct cpu_args*)args)->timer_id;
-	int id = ((struct cpu_args*)args)->id;
-	/* Check for new process in ready queue */
-	int time_left = 0;
-	struct pcb_t * proc = NULL;
-	while (1) {
-		/* Check the status of current process */
-		if (proc == NULL) {
-			/* No process is running, the we load new process from
-		 	* ready queue */
-			proc = get_proc();
-			if (proc == NULL) {
-                           next_slot(timer_id);
-                           continue; /* First load failed. skip dummy load */
-                        }
-		}else if (proc->pc == proc->code->size) {
-			/* The porcess has finish it job */
-			printf("\tCPU %d: Processed %2d has finished\n",
-				id ,proc->pid);
-			free(proc);
-			proc = get_proc();
-			time_left = 0;
-		}else if (time_left == 0) {
-			/* The process has done its job in current time slot */
-			printf("\tCPU %d: Put process %2d to run queue\n",
-				id, proc->pid);
-			put_proc(proc);
-			proc = get_proc();
+	struct cpu_args * cpu = (struct cpu_args*)args;
+	enum step_stat stat;
+	while ((stat = cpu_step(cpu)) != STEP_STOPPED) {
+#ifdef TIMER_WARP
+		if (stat == STEP_IDLE) {
+			next_slot_until(cpu->timer_id, TIMER_NEVER);
+			continue;
 		}
+#endif
+		next_slot(cpu->timer_id);
+	}
+	detach_event(cpu->timer_id);
+	pthread_exit(NULL);
+}
+#endif
 
-		/* Recheck process status after loading new process */
-		if (proc == NULL && done) {
-			/* No process to run, exit */
-			printf("\tCPU %d stopped\n", id);
-			break;
-		}else if (proc == NULL) {
-			/* There may be new processes to run in
-			 * next time slots, just skip current slot */
-			next_slot(timer_id);
+static unsigned long hash_name(const char * name) {
+	unsigned long h = 5381;
+	while (*name)
+		h = h * 33 + (unsigned char)*name++;
+	return h;
+}
+
+/* ld_intern - the program named [name] under input/proc/ */
+static struct ld_prog * ld_intern(const char * name) {
+	struct ld_prog ** bucket = &ld_progs[hash_name(name) % LD_PROG_BUCKETS];
+	struct ld_prog * prog;
+	size_t len = strlen("input/proc/") + strlen(name) + 1;
+
+	for (prog = *bucket; prog != NULL; prog = prog->next)
+		if (!strcmp(prog->path + strlen("input/proc/"), name))
+			return prog;
+
+	prog = malloc(sizeof(struct ld_prog));
+	prog->path = malloc(len);
+	snprintf(prog->path, len, "input/proc/%s", name);
+	prog->code = NULL;
+	prog->next = *bucket;
+	*bucket = prog;
+	if ((nr_progs & (nr_progs - 1)) == 0)
+		ld_prog_list = realloc(ld_prog_list,
+			sizeof(struct ld_prog *) * (nr_progs ? nr_progs * 2 : 1));
+	ld_prog_list[nr_progs++] = prog;
+	return prog;
+}
+
+/* ld_parse - split an arrival line "[time] [program] [prio]" in place.
+ * Returns 0 on a blank or malformed line */
+static int ld_parse(char * line, unsigned long * start_time, char ** name,
+		unsigned long * prio) {
+	char * save, * tok, * end;
+
+	if ((tok = strtok_r(line, " \t\r\n", &save)) == NULL)
+		return 0;
+	*start_time = strtoul(tok, &end, 10);
+	if (*end != '\0' || (*name = strtok_r(NULL, " \t\r\n", &save)) == NULL)
+		return 0;
+	*prio = 0;
+	if ((tok = strtok_r(NULL, " \t\r\n", &save)) != NULL)
+		*prio = strtoul(tok, NULL, 10);
+	return 1;
+}
+
+/* ld_read_next - read the next arrival of the configuration ahead */
+static void ld_read_next(void) {
+	char * name;
+
+	ld_stream.has_next = 0;
+	while (ld_stream.nr_left > 0
+			&& getline(&ld_stream.line, &ld_stream.line_len,
+				ld_stream.file) != -1) {
+		if (!ld_parse(ld_stream.line, &ld_stream.start_time, &name,
+				&ld_stream.prio))
 			continue;
-		}else if (time_left == 0) {
-			printf("\tCPU %d: Dispatched process %2d\n",
-				id, proc->pid);
-			time_left = time_slot;
-		}
+		ld_stream.prog = ld_intern(name);
+		ld_stream.nr_left--;
+		ld_stream.has_next = 1;
+		return;
+	}
+}
 
-		/* Run current process */
-		run(proc);
-		time_left--;
-		next_slot(timer_id);
+static int ld_fetch_next = 0; // Index of the next program to read ahead
+
+static void * ld_fetch_routine(void * args) {
+	int i;
+	while ((i = __atomic_fetch_add(&ld_fetch_next, 1, __ATOMIC_RELAXED))
+			< nr_progs)
+		ld_prog_list[i]->code = load_code(ld_prog_list[i]->path);
+	return NULL;
+}
+
+/* ld_prefetch - read every program on LD_WORKERS threads, so that
+ * admitting a process does not cost any parsing */
+static void ld_prefetch(void) {
+	int nr_workers = (nr_progs < LD_WORKERS) ? nr_progs : LD_WORKERS;
+	pthread_t workers[LD_WORKERS];
+	int i;
+
+	ld_fetch_next = 0;
+	for (i = 0; i < nr_workers; i++)
+		pthread_create(&workers[i], NULL, ld_fetch_routine, NULL);
+	for (i = 0; i < nr_workers; i++)
+		pthread_join(workers[i], NULL);
+}
+
+/* ld_finish - drop the programs and close the configuration. Processes
+ * still running keep their own reference to the code */
+static void ld_finish(void) {
+	int i;
+	for (i = 0; i < nr_progs; i++) {
+		put_code(ld_prog_list[i]->code);
+		free(ld_prog_list[i]->path);
+		free(ld_prog_list[i]);
 	}
-	detach_event(timer_id);
-	pthread_exit(NULL);
+	free(ld_prog_list);
+	ld_prog_list = NULL;
+	nr_progs = 0;
+	memset(ld_progs, 0, sizeof(ld_progs));
+	free(ld_stream.line);
+	fclose(ld_stream.file);
+}
+
+/* ld_admit - create the process of the arrival read ahead and hand it to
+ * the scheduler */
+static void ld_admit(void * args) {
+	struct ld_prog * prog = ld_stream.prog;
+	hold_code(prog->code);
+	struct pcb_t * proc = load_proc(prog->code);
+#ifdef MLQ_SCHED
+	proc->prio = ld_stream.prio;
+#endif
+#ifdef MM_PAGING
+	struct mmpaging_ld_args * mm_args = (struct mmpaging_ld_args *)args;
+	init_mm(proc->mm, proc);
+	proc->mram = mm_args->mram;
+	proc->mswp = mm_args->mswp;
+	proc->active_mswp = mm_args->active_mswp;
+#endif
+	log_printf("\tLoaded a process at %s, PID: %d PRIO: %ld\n",
+		prog->path, proc->pid, ld_stream.prio);
+	add_proc(proc);
 }
 
+/* ld_step - admit every process due in the current slot */
+static enum step_stat ld_step(void * args) {
+	if (!ld_stream.has_next) {
+		ld_finish();
+		done = 1;
+		return STEP_STOPPED;
+	}
+	if (current_time() < ld_stream.start_time)
+		return STEP_IDLE;
+
+	while (ld_stream.has_next && ld_stream.start_time <= current_time()) {
+		ld_admit(args);
+		ld_read_next();
+	}
+	return STEP_BUSY;
+}
+
+#ifndef SIM_LOCKSTEP
 static void * ld_routine(void * args) {
 #ifdef MM_PAGING
-	struct memphy_struct* mram = ((struct mmpaging_ld_args *)args)->mram;
-	struct memphy_struct** mswp = ((struct mmpaging_ld_args *)args)->mswp;
-	struct memphy_struct* active_mswp = ((struct mmpaging_ld_args *)args)->active_mswp;
 	struct timer_id_t * timer_id = ((struct mmpaging_ld_args *)args)->timer_id;
 #else
 	struct timer_id_t * timer_id = (struct timer_id_t*)args;
 #endif
-	int i = 0;
-	printf("ld_routine\n");
-	while (i < num_processes) {
-		struct pcb_t * proc = load(ld_processes.path[i]);
-#ifdef MLQ_SCHED
-		proc->prio = ld_processes.prio[i];
-#endif
-		while (current_time() < ld_processes.start_time[i]) {
-			next_slot(timer_id);
+	enum step_stat stat;
+	log_printf("ld_routine\n");
+	while ((stat = ld_step(args)) != STEP_STOPPED) {
+#ifdef TIMER_WARP
+		if (stat == STEP_IDLE) {
+			next_slot_until(timer_id, ld_stream.start_time);
+			continue;
 		}
-#ifdef MM_PAGING
-		proc->mm = malloc(sizeof(struct mm_struct));
-		init_mm(proc->mm, proc);
-		proc->mram = mram;
-		proc->mswp = mswp;
-		proc->active_mswp = active_mswp;
-#endif
-		printf("\tLoaded a process at %s, PID: %d PRIO: %ld\n",
-			ld_processes.path[i], proc->pid, ld_processes.prio[i]);
-		add_proc(proc);
-		free(ld_processes.path[i]);
-		i++;
+#endif
 		next_slot(timer_id);
 	}
-	free(ld_processes.path);
-	free(ld_processes.start_time);
-	done = 1;
 	detach_event(timer_id);
 	pthread_exit(NULL);
 }
+#endif
+
+#ifdef SIM_LOCKSTEP
+/*
+ * run_lockstep - run the loader and all CPUs in the calling thread
+ * Within a slot the loader goes first, then the CPUs in id order, so the
+ * output of a configuration is always the same
+ */
+static void run_lockstep(struct cpu_args * cpus, void * ld_args) {
+	int ld_running = 1;
+	int nr_running = num_cpus;
+	int * stopped = (int*)calloc(num_cpus, sizeof(int));
+	int i;
+
+	set_current_time(0);
+	log_printf("Time slot %3lu\n", current_time());
+	log_printf("ld_routine\n");
+	while (1) {
+#ifdef TIMER_WARP
+		int busy = 0;
+		uint64_t wake = TIMER_NEVER;
+#endif
+
+		if (ld_running) {
+			enum step_stat stat = ld_step(ld_args);
+			if (stat == STEP_STOPPED)
+				ld_running = 0;
+#ifdef TIMER_WARP
+			else if (stat == STEP_IDLE)
+				wake = ld_stream.start_time;
+			else
+				busy = 1;
+#endif
+		}
+		for (i = 0; i < num_cpus; i++) {
+			if (stopped[i])
+				continue;
+			enum step_stat stat = cpu_step(&cpus[i]);
+			if (stat == STEP_STOPPED) {
+				stopped[i] = 1;
+				nr_running--;
+			}
+#ifdef TIMER_WARP
+			else if (stat == STEP_BUSY) {
+				busy = 1;
+			}
+#endif
+		}
+		if (!ld_running && nr_running == 0)
+			break;
+
+#ifdef TIMER_WARP
+		if (!busy && wake != TIMER_NEVER && wake > current_time() + 1) {
+			set_current_time(wake);
+		}else
+#endif
+		set_current_time(current_time() + 1);
+		log_printf("Time slot %3lu\n", current_time());
+	}
+	free(stopped);
+}
+#endif
 
 static void read_config(const char * path) {
 	FILE * file;
@@ -145,9 +383,6 @@ static void read_config(const char * path) {
 		exit(1);
 	}
 	fscanf(file, "%d %d %d\n", &time_slot, &num_cpus, &num_processes);
-	ld_processes.path = (char**)malloc(sizeof(char*) * num_processes);
-	ld_processes.start_time = (unsigned long*)
-		malloc(sizeof(unsigned long) * num_processes);
 #ifdef MM_PAGING
 	int sit;
 #ifdef MM_FIXED_MEMSZ
@@ -173,36 +408,47 @@ static void read_config(const char * path) {
 #endif
 #endif
 
-#ifdef MLQ_SCHED
-	ld_processes.prio = (unsigned long*)
-		malloc(sizeof(unsigned long) * num_processes);
-#endif
-	int i;
-	for (i = 0; i < num_processes; i++) {
-		ld_processes.path[i] = (char*)malloc(sizeof(char) * 100);
-		ld_processes.path[i][0] = '\0';
-		strcat(ld_processes.path[i], "input/proc/");
-		char proc[100];
-#ifdef MLQ_SCHED
-		fscanf(file, "%lu %s %lu\n", &ld_processes.start_time[i], proc, &ld_processes.prio[i]);
-#else
-		fscanf(file, "%lu %s\n", &ld_processes.start_time[i], proc);
-#endif
-		strcat(ld_processes.path[i], proc);
-	}
+	/* Intern the programs in a first pass, then stream the arrivals */
+	long arrivals = ftell(file);
+	char * line = NULL, * name;
+	size_t line_len = 0;
+	unsigned long start_time, prio;
+	int i = 0;
+	while (i < num_processes && getline(&line, &line_len, file) != -1)
+		if (ld_parse(line, &start_time, &name, &prio)) {
+			ld_intern(name);
+			i++;
+		}
+	free(line);
+	fseek(file, arrivals, SEEK_SET);
+
+	ld_stream.file = file;
+	ld_stream.line = NULL;
+	ld_stream.line_len = 0;
+	ld_stream.nr_left = num_processes;
+	ld_read_next();
 }
 
 int main(int argc, char * argv[]) {
 	/* Read config */
-	if (argc != 2) {
-		printf("Usage: os [path to configure file]\n");
+	if (argc != 2 && argc != 3) {
+		printf("Usage: os [path to configure file] [mlq|fifo|fair]\n");
+		return 1;
+	}
+	if (argc == 3 && sched_set_policy(argv[2]) != 0) {
+		printf("Unknown scheduling policy %s\n", argv[2]);
 		return 1;
 	}
-	char path[100];
-	path[0] = '\0';
-	strcat(path, "input/");
-	strcat(path, argv[1]);
+	size_t len = strlen("input/") + strlen(argv[1]) + 1;
+	char * path = malloc(len);
+	snprintf(path, len, "input/%s", argv[1]);
 	read_config(path);
+	free(path);
+	ld_prefetch();
+	log_start();
+#ifdef MM_TRACE
+	mm_trace_start(MM_TRACE);
+#endif
 
 	pthread_t * cpu = (pthread_t*)malloc(num_cpus * sizeof(pthread_t));
 	struct cpu_args * args =
@@ -212,11 +458,31 @@ int main(int argc, char * argv[]) {
 	/* Init timer */
 	int i;
 	for (i = 0; i < num_cpus; i++) {
+#ifdef SIM_LOCKSTEP
+		args[i].timer_id = NULL;
+#else
 		args[i].timer_id = attach_event();
+#endif
 		args[i].id = i;
+		args[i].time_left = 0;
+		args[i].proc = NULL;
 	}
+#ifdef CPU_AFFINITY
+	affinity_init(CPU_AFFINITY);
+#endif
+#ifdef SIM_LOCKSTEP
+	struct timer_id_t * ld_event = NULL;
+#ifdef CPU_AFFINITY
+	affinity_pin(pthread_self(), AFF_CPU, 0);
+#endif
+#else
 	struct timer_id_t * ld_event = attach_event();
+#ifdef CPU_AFFINITY
+	/* The timer thread inherits the placement of its creator */
+	affinity_pin(pthread_self(), AFF_TIMER, 0);
+#endif
 	start_timer();
+#endif
 
 #ifdef MM_PAGING
 	/* Init all MEMPHY include 1 MEMRAM and n of MEMSWP */
@@ -245,17 +511,44 @@ int main(int argc, char * argv[]) {
 
 
 	/* Init scheduler */
-	init_scheduler();
+#ifdef SIM_LOCKSTEP
+	int threaded = 0;
+#else
+	int threaded = 1;
+#endif
+#ifdef SCHED_PERCPU_RQ
+	init_scheduler(num_cpus, threaded);
+#else
+	init_scheduler(1, threaded);
+#endif
+	stats_init(num_cpus);
+	tlb_init(num_cpus);
 
+#ifdef SIM_LOCKSTEP
+	/* Run CPU and loader in this thread, no timer is needed */
+	(void)cpu;
+	(void)ld;
+#ifdef MM_PAGING
+	run_lockstep(args, (void*)mm_ld_args);
+#else
+	run_lockstep(args, (void*)ld_event);
+#endif
+#else
 	/* Run CPU and loader */
 #ifdef MM_PAGING
 	pthread_create(&ld, NULL, ld_routine, (void*)mm_ld_args);
 #else
 	pthread_create(&ld, NULL, ld_routine, (void*)ld_event);
+#endif
+#ifdef CPU_AFFINITY
+	affinity_pin(ld, AFF_LOADER, 0);
 #endif
 	for (i = 0; i < num_cpus; i++) {
 		pthread_create(&cpu[i], NULL,
 			cpu_routine, (void*)&args[i]);
+#ifdef CPU_AFFINITY
+		affinity_pin(cpu[i], AFF_CPU, i);
+#endif
 	}
 
 	/* Wait for CPU and loader finishing */
@@ -266,6 +559,28 @@ int main(int argc, char * argv[]) {
 
 	/* Stop timer */
 	stop_timer();
+#endif
+#ifdef SCHED_STATS
+	stats_dump(SCHED_STATS);
+#endif
+	mm_trace_stop();
+	tlb_finish();
+	finish_scheduler();
+	log_stop();
+#ifdef CPU_AFFINITY
+	affinity_finish();
+#endif
+#ifdef MM_PAGING
+#ifdef MM_FRAG_STATS
+	MEMPHY_dump_frag(&mram, "ram");
+#endif
+	free_memphy(&mram);
+	for(sit = 0; sit < PAGING_MAX_MMSWP; sit++)
+		free_memphy(&mswp[sit]);
+	free(mm_ld_args);
+#endif
+	free(cpu);
+	free(args);
 
 	return 0;
 
@@ -1,28 +1,64 @@
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include "queue.h"
 
+void init_queue(struct queue_t * q) {
+        q->proc = NULL;
+        q->head = 0;
+        q->size = 0;
+        q->capacity = 0;
+}
+
+void free_queue(struct queue_t * q) {
+        free(q->proc);
+        init_queue(q);
+}
+
+/* Double the capacity of [q], unwrapping its entries to the front of the
+ * new buffer */
+static void grow_queue(struct queue_t * q) {
+        int capacity = q->capacity ? q->capacity * 2 : QUEUE_INIT_SIZE;
+        struct pcb_t ** proc = malloc(sizeof(struct pcb_t *) * capacity);
+        if (proc == NULL) {
+                printf("Cannot grow queue to %d entries\n", capacity);
+                exit(1);
+        }
+        if (q->size > 0) {
+                int first = q->capacity - q->head;
+                if (first > q->size)
+                        first = q->size;
+                memcpy(proc, q->proc + q->head, sizeof(*proc) * first);
+                memcpy(proc + first, q->proc, sizeof(*proc) * (q->size - first));
+        }
+        free(q->proc);
+        q->proc = proc;
+        q->head = 0;
+        q->capacity = capacity;
+}
+
 int empty(struct queue_t * q) {
         if (q == NULL) return 1;
 	return (q->size == 0);
 }
 
 void enqueue(struct queue_t * q, struct pcb_t * proc) {
-        /* TODO: put a new process to queue [q] */
-        (q->proc)[q->size] = proc;
+        /* put a new process to the tail of queue [q] */
+        if (q->size == q->capacity)
+                grow_queue(q);
+        q->proc[(q->head + q->size) & (q->capacity - 1)] = proc;
         q->size++;
 }
 
 struct pcb_t * dequeue(struct queue_t * q) {
-        /* TODO: return a pcb whose prioprity is the highest
-         * in the queue [q] and remember to remove it from q
+        /* return the process at the head of queue [q], the one which
+         * has been waiting longest, and remove it from q
          * */
         if(empty(q))
                 return NULL;
-        struct pcb_t* ret = (q->proc)[0];
-        for(int i = 0; i < q->size-1; i++){
-                (q->proc)[i] = (q->proc)[i+1];
-        }
+        struct pcb_t* ret = q->proc[q->head];
+        q->head = (q->head + 1) & (q->capacity - 1);
         q->size--;
         return ret;
 }
+
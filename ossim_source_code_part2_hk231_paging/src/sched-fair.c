@@ -0,0 +1,165 @@
+/*
+ * Fair policy
+ * Every process accumulates virtual runtime while it runs, at a rate
+ * inversely proportional to its weight MAX_PRIO - prio. The process with
+ * the smallest virtual runtime runs next, so every process gets a CPU
+ * share proportional to its weight and none of them starves. Waiting
+ * processes are kept in an AVL tree ordered by virtual runtime.
+ */
+
+#include "sched-policy.h"
+#include <stddef.h>
+#include <stdlib.h>
+
+/* Virtual runtime of one time slot at weight 1 */
+#define FAIR_SCALE	(1 << 20)
+
+#define fair_entry(node) \
+	((struct pcb_t *)((char *)(node) - offsetof(struct pcb_t, fair)))
+
+struct fair_rq {
+	struct fair_node * root;
+	uint64_t min_vruntime;	// Never decreases, new processes start here
+	uint64_t seq;
+};
+
+static uint32_t fair_weight(struct pcb_t * proc) {
+#ifdef MLQ_SCHED
+	uint32_t prio = proc->prio;
+#else
+	uint32_t prio = proc->priority;
+#endif
+	if (prio >= MAX_PRIO)
+		prio = MAX_PRIO - 1;
+	return MAX_PRIO - prio;
+}
+
+static inline int fair_height(struct fair_node * node) {
+	return node ? node->height : 0;
+}
+
+static void fair_update(struct fair_node * node) {
+	int l = fair_height(node->left), r = fair_height(node->right);
+	node->height = 1 + ((l > r) ? l : r);
+}
+
+static struct fair_node * fair_rotate_right(struct fair_node * y) {
+	struct fair_node * x = y->left;
+	y->left = x->right;
+	x->right = y;
+	fair_update(y);
+	fair_update(x);
+	return x;
+}
+
+static struct fair_node * fair_rotate_left(struct fair_node * x) {
+	struct fair_node * y = x->right;
+	x->right = y->left;
+	y->left = x;
+	fair_update(x);
+	fair_update(y);
+	return y;
+}
+
+static struct fair_node * fair_balance(struct fair_node * node) {
+	int bf;
+
+	fair_update(node);
+	bf = fair_height(node->left) - fair_height(node->right);
+	if (bf > 1) {
+		if (fair_height(node->left->left) < fair_height(node->left->right))
+			node->left = fair_rotate_left(node->left);
+		return fair_rotate_right(node);
+	}
+	if (bf < -1) {
+		if (fair_height(node->right->right) < fair_height(node->right->left))
+			node->right = fair_rotate_right(node->right);
+		return fair_rotate_left(node);
+	}
+	return node;
+}
+
+static inline int fair_less(struct fair_node * a, struct fair_node * b) {
+	if (a->vruntime != b->vruntime)
+		return a->vruntime < b->vruntime;
+	return a->seq < b->seq;
+}
+
+static struct fair_node * fair_insert(struct fair_node * root,
+		struct fair_node * node) {
+	if (root == NULL) {
+		node->left = node->right = NULL;
+		node->height = 1;
+		return node;
+	}
+	if (fair_less(node, root))
+		root->left = fair_insert(root->left, node);
+	else
+		root->right = fair_insert(root->right, node);
+	return fair_balance(root);
+}
+
+static struct fair_node * fair_remove_min(struct fair_node * root,
+		struct fair_node ** min) {
+	if (root->left == NULL) {
+		*min = root;
+		return root->right;
+	}
+	root->left = fair_remove_min(root->left, min);
+	return fair_balance(root);
+}
+
+static void * fair_init_rq(void) {
+	return calloc(1, sizeof(struct fair_rq));
+}
+
+static void fair_free_rq(void * priv) {
+	free(priv);
+}
+
+static void fair_enqueue(struct fair_rq * rq, struct pcb_t * proc) {
+	proc->fair.seq = rq->seq++;
+	rq->root = fair_insert(rq->root, &proc->fair);
+}
+
+static struct pcb_t * fair_pick_next(void * priv) {
+	struct fair_rq * rq = priv;
+	struct fair_node * min;
+
+	if (rq->root == NULL)
+		return NULL;
+	rq->root = fair_remove_min(rq->root, &min);
+	if (min->vruntime > rq->min_vruntime)
+		rq->min_vruntime = min->vruntime;
+	return fair_entry(min);
+}
+
+static void fair_put_prev(void * priv, struct pcb_t * proc) {
+	struct fair_rq * rq = priv;
+	/* A process stolen from another CPU must not jump ahead of the
+	 * processes of this one */
+	if (proc->fair.vruntime < rq->min_vruntime)
+		proc->fair.vruntime = rq->min_vruntime;
+	fair_enqueue(rq, proc);
+}
+
+static void fair_enqueue_new(void * priv, struct pcb_t * proc) {
+	struct fair_rq * rq = priv;
+	proc->fair.vruntime = rq->min_vruntime;
+	fair_enqueue(rq, proc);
+}
+
+static void fair_tick(struct pcb_t * proc) {
+	proc->fair.vruntime += FAIR_SCALE / fair_weight(proc);
+}
+
+const struct sched_policy fair_policy = {
+	.name = "fair",
+	.init_rq = fair_init_rq,
+	.free_rq = fair_free_rq,
+	.pick_next = fair_pick_next,
+	.put_prev = fair_put_prev,
+	.enqueue_new = fair_enqueue_new,
+	.tick = fair_tick,
+};
+
@@ -0,0 +1,60 @@
+/*
+ * FIFO policy
+ * New processes wait in ready_queue, preempted ones in run_queue. Once
+ * ready_queue is drained the processes of run_queue get their next turn
+ */
+
+#include "sched-policy.h"
+#include "queue.h"
+#include <stdlib.h>
+
+struct fifo_rq {
+	struct queue_t ready_queue;
+	struct queue_t run_queue;
+};
+
+static void * fifo_init_rq(void) {
+	struct fifo_rq * rq = malloc(sizeof(struct fifo_rq));
+	init_queue(&rq->ready_queue);
+	init_queue(&rq->run_queue);
+	return rq;
+}
+
+static void fifo_free_rq(void * priv) {
+	struct fifo_rq * rq = priv;
+	free_queue(&rq->ready_queue);
+	free_queue(&rq->run_queue);
+	free(rq);
+}
+
+static struct pcb_t * fifo_pick_next(void * priv) {
+	struct fifo_rq * rq = priv;
+	if (empty(&rq->ready_queue)) {
+		/* Start a new round with the preempted processes */
+		struct queue_t tmp = rq->ready_queue;
+		rq->ready_queue = rq->run_queue;
+		rq->run_queue = tmp;
+	}
+	return dequeue(&rq->ready_queue);
+}
+
+static void fifo_put_prev(void * priv, struct pcb_t * proc) {
+	struct fifo_rq * rq = priv;
+	enqueue(&rq->run_queue, proc);
+}
+
+static void fifo_enqueue_new(void * priv, struct pcb_t * proc) {
+	struct fifo_rq * rq = priv;
+	enqueue(&rq->ready_queue, proc);
+}
+
+const struct sched_policy fifo_policy = {
+	.name = "fifo",
+	.init_rq = fifo_init_rq,
+	.free_rq = fifo_free_rq,
+	.pick_next = fifo_pick_next,
+	.put_prev = fifo_put_prev,
+	.enqueue_new = fifo_enqueue_new,
+	.tick = NULL,
+};
+
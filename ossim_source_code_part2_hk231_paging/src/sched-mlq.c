@@ -0,0 +1,109 @@
+/*
+ * Multi level queue policy
+ * Level prio may dispatch MAX_PRIO - prio times in a round before lower
+ * levels get the CPU, a new round starts when every non-empty level has
+ * used up its budget
+ */
+
+#include "sched-policy.h"
+#include "queue.h"
+#include "bitops.h"
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef MLQ_SCHED
+struct mlq_rq {
+	struct queue_t ready_queue[MAX_PRIO];
+	/* Levels having at least one process */
+	unsigned long ready_map[BITS_TO_LONGS(MAX_PRIO)];
+	/* Levels which still have slot budget left in the current round */
+	unsigned long slot_map[BITS_TO_LONGS(MAX_PRIO)];
+	/* Budget of a level is refilled lazily, when its epoch falls behind
+	 * the rq epoch it is taken as MAX_PRIO - prio again */
+	unsigned long slot_epoch[MAX_PRIO];
+	unsigned long epoch;
+};
+
+static void * mlq_init_rq(void) {
+	struct mlq_rq * rq = calloc(1, sizeof(struct mlq_rq));
+	int prio;
+	for (prio = 0; prio < MAX_PRIO; prio ++) {
+		init_queue(&rq->ready_queue[prio]);
+		rq->ready_queue[prio].time_slot = MAX_PRIO - prio;
+		__set_bit(prio, rq->slot_map);
+	}
+	return rq;
+}
+
+static void mlq_free_rq(void * priv) {
+	struct mlq_rq * rq = priv;
+	int prio;
+	for (prio = 0; prio < MAX_PRIO; prio++)
+		free_queue(&rq->ready_queue[prio]);
+	free(rq);
+}
+
+/* Refill the slot budget of every level in O(1) by starting a new round */
+static void mlq_refill(struct mlq_rq * rq) {
+	int i;
+	rq->epoch++;
+	for (i = 0; i < BITS_TO_LONGS(MAX_PRIO); i++)
+		rq->slot_map[i] = ~0UL;
+}
+
+static void mlq_enqueue(void * priv, struct pcb_t * proc) {
+	struct mlq_rq * rq = priv;
+	enqueue(&rq->ready_queue[proc->prio], proc);
+	__set_bit(proc->prio, rq->ready_map);
+}
+
+static struct pcb_t * mlq_dequeue(struct mlq_rq * rq, int prio) {
+	struct queue_t * q = &rq->ready_queue[prio];
+	struct pcb_t * proc = dequeue(q);
+
+	if (empty(q))
+		__clear_bit(prio, rq->ready_map);
+	if (rq->slot_epoch[prio] != rq->epoch) {
+		rq->slot_epoch[prio] = rq->epoch;
+		q->time_slot = MAX_PRIO - prio;
+	}
+	if (--q->time_slot <= 0)
+		__clear_bit(prio, rq->slot_map);
+	return proc;
+}
+
+/*
+ *  Stateful design for routine calling
+ *  based on the priority and our MLQ policy
+ *  We implement stateful here using transition technique
+ *  State representation   prio = 0 .. MAX_PRIO, curr_slot = 0..(MAX_PRIO - prio)
+ *  The highest non-empty level having slot budget left is the first bit
+ *  set in both ready_map and slot_map
+ */
+static struct pcb_t * mlq_pick_next(void * priv) {
+	struct mlq_rq * rq = priv;
+	int prio = find_first_bit(rq->ready_map, MAX_PRIO);
+	if (prio == MAX_PRIO)
+		return NULL;
+
+	prio = find_first_and_bit(rq->ready_map, rq->slot_map, MAX_PRIO);
+	if (prio == MAX_PRIO) {
+	// non_empty but run out of timeslot
+	// Must provide timeslot again
+		mlq_refill(rq);
+		prio = find_first_bit(rq->ready_map, MAX_PRIO);
+	}
+	return mlq_dequeue(rq, prio);
+}
+
+const struct sched_policy mlq_policy = {
+	.name = "mlq",
+	.init_rq = mlq_init_rq,
+	.free_rq = mlq_free_rq,
+	.pick_next = mlq_pick_next,
+	.put_prev = mlq_enqueue,
+	.enqueue_new = mlq_enqueue,
+	.tick = NULL,
+};
+#endif
+
@@ -1,128 +1,196 @@
 
-#include "queue.h"
 #include "sched.h"
+#include "sched-policy.h"
+#include "stats.h"
 #include <pthread.h>
 
 #include <stdlib.h>
 #include <stdio.h>
-static struct queue_t ready_queue;
-static struct queue_t run_queue;
-static pthread_mutex_t queue_lock;
+#include <string.h>
 
+/* Run queue owned by one (or a group of) CPU. Every rq has its own lock
+ * and its own cache line, so CPUs working on different rqs never contend
+ * with each other */
+struct sched_rq {
+	pthread_mutex_t lock;
+	/* Number of processes waiting in this rq. Only written with [lock]
+	 * held, read without it as a hint for balancing and stealing */
+	int nr_ready;
+	void * priv; // State of the policy for this rq
+} __attribute__((aligned(64)));
+
+static const struct sched_policy * policies[] = {
 #ifdef MLQ_SCHED
-static struct queue_t mlq_ready_queue[MAX_PRIO];
+	&mlq_policy,
 #endif
+	&fifo_policy,
+	&fair_policy,
+};
+
+#define NR_POLICIES	(int)(sizeof(policies) / sizeof(policies[0]))
 
-int queue_empty(void) {
 #ifdef MLQ_SCHED
-	unsigned long prio;
-	for (prio = 0; prio < MAX_PRIO; prio++)
-		if(!empty(&mlq_ready_queue[prio]))
-			return -1;
+static const struct sched_policy * policy = &mlq_policy;
+#else
+static const struct sched_policy * policy = &fifo_policy;
 #endif
-	return (empty(&ready_queue) && empty(&run_queue));
+static struct sched_rq * rqs;
+static int nr_rqs;
+static unsigned int rq_cursor; // Round-robin start point of add_proc
+static int rq_locked; // Lock rqs, cleared when only one thread schedules
+
+static inline struct sched_rq * cpu_rq(int cpu) {
+	return &rqs[cpu % nr_rqs];
 }
 
-void init_scheduler(void) {
-#ifdef MLQ_SCHED
-    int i ;
+static inline void rq_lock(struct sched_rq * rq) {
+	if (rq_locked)
+		pthread_mutex_lock(&rq->lock);
+}
 
-	for (i = 0; i < MAX_PRIO; i ++) {
-		mlq_ready_queue[i].size = 0;
-		mlq_ready_queue[i].time_slot = MAX_PRIO - i;
-	}
-#endif
-	ready_queue.size = 0;
-	run_queue.size = 0;
-	pthread_mutex_init(&queue_lock, NULL);
+static inline void rq_unlock(struct sched_rq * rq) {
+	if (rq_locked)
+		pthread_mutex_unlock(&rq->lock);
 }
 
-#ifdef MLQ_SCHED
-/*
- *  Stateful design for routine calling
- *  based on the priority and our MLQ policy
- *  We implement stateful here using transition technique
- *  State representation   prio = 0 .. MAX_PRIO, curr_slot = 0..(MAX_PRIO - prio)
- */
-struct pcb_t * get_mlq_proc(void) {
-	struct pcb_t * proc = NULL;
-	/*TODO: get a process from PRIORITY [ready_queue].
-	 * Remember to use lock to protect the queue.
-	 * */
-	pthread_mutex_lock(&queue_lock);
-	int prio;
-	int non_empty = 0; // check if the mlq_queue is truly empty
-	for (prio = MAX_PRIO; prio < 0; prio++) {
-		if(!empty(&mlq_ready_queue[prio])) {
-			non_empty = 1; // there is a non_empty queue level
-			if(mlq_ready_queue[prio].time_slot > 0) {
-				proc = dequeue(&mlq_ready_queue[prio]);
-				mlq_ready_queue[prio].time_slot--;
-				break;
-			}
+static inline int rq_load(struct sched_rq * rq) {
+	return __atomic_load_n(&rq->nr_ready, __ATOMIC_RELAXED);
+}
+
+static inline void rq_set_load(struct sched_rq * rq, int delta) {
+	__atomic_store_n(&rq->nr_ready, rq->nr_ready + delta, __ATOMIC_RELAXED);
+}
+
+int sched_set_policy(const char * name) {
+	int i;
+	if (strcmp(name, "cfs") == 0)
+		name = "fair";
+	for (i = 0; i < NR_POLICIES; i++) {
+		if (strcmp(policies[i]->name, name) == 0) {
+			policy = policies[i];
+			return 0;
 		}
 	}
-	if(proc == NULL && non_empty == 1) {
-	// non_empty but run out of timeslot
-	// Must provide timeslot again
-		for(prio = 0; prio < MAX_PRIO; prio++)
-			mlq_ready_queue[prio].time_slot = MAX_PRIO - prio;
-		for (prio = MAX_PRIO; prio < 0; prio++)
-			if(!empty(&mlq_ready_queue[prio])) {
-				proc = dequeue(&mlq_ready_queue[prio]);
-				mlq_ready_queue[prio].time_slot--;
-				break;
-			}
-	}
-	pthread_mutex_unlock(&queue_lock);
-	return proc;
+	return -1;
 }
 
-void put_mlq_proc(struct pcb_t * proc) {
-	pthread_mutex_lock(&queue_lock);
-	enqueue(&mlq_ready_queue[proc->prio], proc);
-	pthread_mutex_unlock(&queue_lock);
+const char * sched_policy_name(void) {
+	return policy->name;
 }
 
-void add_mlq_proc(struct pcb_t * proc) {
-	pthread_mutex_lock(&queue_lock);
-	enqueue(&mlq_ready_queue[proc->prio], proc);
-	pthread_mutex_unlock(&queue_lock);
+int queue_empty(void) {
+	int i;
+	for (i = 0; i < nr_rqs; i++)
+		if (rq_load(&rqs[i]) > 0)
+			return 0;
+	return 1;
 }
 
-struct pcb_t * get_proc(void) {
-	return get_mlq_proc();
+void init_scheduler(int num_rqs, int threaded) {
+	int i;
+
+	nr_rqs = (num_rqs > 0) ? num_rqs : 1;
+	rq_locked = threaded;
+	rq_cursor = 0;
+	rqs = (struct sched_rq *)aligned_alloc(64,
+		nr_rqs * sizeof(struct sched_rq));
+	memset(rqs, 0, nr_rqs * sizeof(struct sched_rq));
+	for (i = 0; i < nr_rqs; i++) {
+		struct sched_rq * rq = &rqs[i];
+		rq->priv = policy->init_rq();
+		rq->nr_ready = 0;
+		pthread_mutex_init(&rq->lock, NULL);
+	}
 }
 
-void put_proc(struct pcb_t * proc) {
-	return put_mlq_proc(proc);
+void finish_scheduler(void) {
+	int i;
+	for (i = 0; i < nr_rqs; i++) {
+		struct sched_rq * rq = &rqs[i];
+		policy->free_rq(rq->priv);
+		pthread_mutex_destroy(&rq->lock);
+	}
+	free(rqs);
+	rqs = NULL;
+	nr_rqs = 0;
 }
 
-void add_proc(struct pcb_t * proc) {
-	return add_mlq_proc(proc);
+/* Caller must hold rq->lock */
+static struct pcb_t * rq_pick(struct sched_rq * rq) {
+	struct pcb_t * proc = policy->pick_next(rq->priv);
+	if (proc != NULL)
+		rq_set_load(rq, -1);
+	return proc;
 }
-#else
-struct pcb_t * get_proc(void) {
+
+/*
+ * steal_proc - pull one process from the run queue of another CPU
+ * Victims are probed in order starting right after [cpu], so idle CPUs
+ * spread their stealing over different victims
+ */
+static struct pcb_t * steal_proc(int cpu) {
+	int i;
+	struct sched_rq * self = cpu_rq(cpu);
+	for (i = 1; i < nr_rqs; i++) {
+		struct sched_rq * victim = &rqs[(cpu + i) % nr_rqs];
+		if (victim == self || rq_load(victim) == 0)
+			continue;
+		rq_lock(victim);
+		struct pcb_t * proc = rq_pick(victim);
+		rq_unlock(victim);
+		if (proc != NULL)
+			return proc;
+	}
+	return NULL;
+}
+
+struct pcb_t * get_proc(int cpu) {
 	struct pcb_t * proc = NULL;
-	/*TODO: get a process from [ready_queue].
-	 * Remember to use lock to protect the queue.
-	 * */
-	pthread_mutex_lock(&queue_lock);
-	if(!empty(&ready_queue))
-		proc = dequeue(&ready_queue);
-	pthread_mutex_unlock(&queue_lock);
+	struct sched_rq * rq = cpu_rq(cpu);
+
+	/* Skip the lock of an idle rq, the loader or a victim will refill it
+	 * later and we will see it on next slot */
+	if (rq_load(rq) > 0) {
+		rq_lock(rq);
+		proc = rq_pick(rq);
+		rq_unlock(rq);
+	}
+	if (proc == NULL && nr_rqs > 1)
+		proc = steal_proc(cpu);
+	if (proc != NULL)
+		stats_dispatch(proc);
 	return proc;
 }
 
-void put_proc(struct pcb_t * proc) {
-	pthread_mutex_lock(&queue_lock);
-	enqueue(&run_queue, proc);
-	pthread_mutex_unlock(&queue_lock);
+void put_proc(int cpu, struct pcb_t * proc) {
+	struct sched_rq * rq = cpu_rq(cpu);
+	stats_preempt(proc);
+	rq_lock(rq);
+	policy->put_prev(rq->priv, proc);
+	rq_set_load(rq, 1);
+	rq_unlock(rq);
 }
 
 void add_proc(struct pcb_t * proc) {
-	pthread_mutex_lock(&queue_lock);
-	enqueue(&ready_queue, proc);
-	pthread_mutex_unlock(&queue_lock);
+	/* Spread new arrivals, the least loaded rq gets the process. Ties
+	 * are broken by a rotating start point */
+	stats_arrive(proc);
+	unsigned int start = __atomic_fetch_add(&rq_cursor, 1, __ATOMIC_RELAXED);
+	struct sched_rq * rq = &rqs[start % nr_rqs];
+	int i;
+	for (i = 1; i < nr_rqs; i++) {
+		struct sched_rq * cand = &rqs[(start + i) % nr_rqs];
+		if (rq_load(cand) < rq_load(rq))
+			rq = cand;
+	}
+	rq_lock(rq);
+	policy->enqueue_new(rq->priv, proc);
+	rq_set_load(rq, 1);
+	rq_unlock(rq);
 }
-#endif
+
+void tick_proc(struct pcb_t * proc) {
+	if (policy->tick != NULL)
+		policy->tick(proc);
+}
+
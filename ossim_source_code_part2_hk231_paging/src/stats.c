@@ -0,0 +1,227 @@
+
+#include "stats.h"
+#include "timer.h"
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef SCHED_STATS
+
+/* Metrics kept of a finished process, its PCB is freed right after */
+struct stats_rec {
+	uint32_t pid;
+	uint32_t prio;
+	struct proc_stats st;
+};
+
+/* Columns derived from a record, in the order they are printed */
+enum stats_metric {
+	STAT_RESPONSE,		// first_run - arrival
+	STAT_WAIT,		// wait
+	STAT_TURNAROUND,	// finish - arrival
+	STAT_DISPATCHES,	// nr_dispatch
+	NR_STATS
+};
+
+static const char * metric_names[NR_STATS] = {
+	"response", "wait", "turnaround", "dispatches"
+};
+
+static const int percentiles[] = { 50, 90, 99, 100 };
+#define NR_PERCENTILES	(int)(sizeof(percentiles) / sizeof(percentiles[0]))
+
+static struct stats_rec * recs = NULL;
+static int nr_recs = 0;
+static int max_recs = 0;
+static pthread_mutex_t recs_lock = PTHREAD_MUTEX_INITIALIZER;
+
+/* Slots a CPU ran a process, one cache line per CPU as every CPU thread
+ * counts its own on each busy slot */
+struct cpu_busy {
+	uint64_t slots;
+} __attribute__((aligned(64)));
+
+static struct cpu_busy * cpu_busy = NULL;
+static int nr_cpus = 0;
+
+void stats_init(int num_cpus) {
+	nr_cpus = num_cpus;
+	cpu_busy = aligned_alloc(64, sizeof(struct cpu_busy) * num_cpus);
+	memset(cpu_busy, 0, sizeof(struct cpu_busy) * num_cpus);
+	nr_recs = 0;
+}
+
+void stats_arrive(struct pcb_t * proc) {
+	memset(&proc->stats, 0, sizeof(proc->stats));
+	proc->stats.arrival = proc->stats.ready = current_time();
+}
+
+void stats_dispatch(struct pcb_t * proc) {
+	uint64_t now = current_time();
+	if (proc->stats.nr_dispatch++ == 0)
+		proc->stats.first_run = now;
+	proc->stats.wait += now - proc->stats.ready;
+}
+
+void stats_preempt(struct pcb_t * proc) {
+	proc->stats.ready = current_time();
+}
+
+void stats_finish(struct pcb_t * proc) {
+	proc->stats.finish = current_time();
+	pthread_mutex_lock(&recs_lock);
+	if (nr_recs == max_recs) {
+		max_recs = max_recs ? max_recs * 2 : 64;
+		recs = realloc(recs, max_recs * sizeof(struct stats_rec));
+	}
+	struct stats_rec * rec = &recs[nr_recs++];
+	rec->pid = proc->pid;
+#ifdef MLQ_SCHED
+	rec->prio = proc->prio;
+#else
+	rec->prio = proc->priority;
+#endif
+	rec->st = proc->stats;
+	pthread_mutex_unlock(&recs_lock);
+}
+
+void stats_busy(int cpu) {
+	/* Each CPU only writes its own counter */
+	cpu_busy[cpu].slots++;
+}
+
+static uint64_t stats_metric(struct stats_rec * rec, int metric) {
+	switch (metric) {
+	case STAT_RESPONSE:	return rec->st.first_run - rec->st.arrival;
+	case STAT_WAIT:		return rec->st.wait;
+	case STAT_TURNAROUND:	return rec->st.finish - rec->st.arrival;
+	default:		return rec->st.nr_dispatch;
+	}
+}
+
+static int cmp_u64(const void * a, const void * b) {
+	uint64_t x = *(const uint64_t *)a, y = *(const uint64_t *)b;
+	return (x > y) - (x < y);
+}
+
+/* Nearest rank percentiles and mean of [metric] over every record */
+static void stats_summary(int metric, uint64_t * pct, double * mean) {
+	uint64_t * val = malloc(nr_recs * sizeof(uint64_t));
+	double sum = 0;
+	int i;
+
+	for (i = 0; i < nr_recs; i++) {
+		val[i] = stats_metric(&recs[i], metric);
+		sum += val[i];
+	}
+	qsort(val, nr_recs, sizeof(uint64_t), cmp_u64);
+	for (i = 0; i < NR_PERCENTILES; i++) {
+		int rank = (percentiles[i] * nr_recs + 99) / 100;
+		pct[i] = val[(rank > 0) ? rank - 1 : 0];
+	}
+	*mean = sum / nr_recs;
+	free(val);
+}
+
+static void dump_csv(FILE * file, uint64_t span) {
+	uint64_t pct[NR_PERCENTILES];
+	double mean;
+	int i, m;
+
+	fprintf(file, "pid,prio,arrival,first_run,finish,"
+		"response,wait,turnaround,dispatches\n");
+	for (i = 0; i < nr_recs; i++) {
+		struct stats_rec * rec = &recs[i];
+		fprintf(file, "%u,%u,%lu,%lu,%lu", rec->pid, rec->prio,
+			rec->st.arrival, rec->st.first_run, rec->st.finish);
+		for (m = 0; m < NR_STATS; m++)
+			fprintf(file, ",%lu", stats_metric(rec, m));
+		fprintf(file, "\n");
+	}
+
+	fprintf(file, "\nmetric");
+	for (i = 0; i < NR_PERCENTILES; i++)
+		fprintf(file, ",p%d", percentiles[i]);
+	fprintf(file, ",mean\n");
+	for (m = 0; nr_recs > 0 && m < NR_STATS; m++) {
+		stats_summary(m, pct, &mean);
+		fprintf(file, "%s", metric_names[m]);
+		for (i = 0; i < NR_PERCENTILES; i++)
+			fprintf(file, ",%lu", pct[i]);
+		fprintf(file, ",%.2f\n", mean);
+	}
+
+	fprintf(file, "\ncpu,busy,utilization\n");
+	for (i = 0; i < nr_cpus; i++)
+		fprintf(file, "%d,%lu,%.4f\n", i, cpu_busy[i].slots,
+			span ? (double)cpu_busy[i].slots / span : 0.0);
+}
+
+static void dump_json(FILE * file, uint64_t span) {
+	uint64_t pct[NR_PERCENTILES];
+	double mean;
+	int i, m;
+
+	fprintf(file, "{\n  \"slots\": %lu,\n  \"processes\": [", span);
+	for (i = 0; i < nr_recs; i++) {
+		struct stats_rec * rec = &recs[i];
+		fprintf(file, "%s\n    {\"pid\": %u, \"prio\": %u, "
+			"\"arrival\": %lu, \"first_run\": %lu, \"finish\": %lu",
+			i ? "," : "", rec->pid, rec->prio,
+			rec->st.arrival, rec->st.first_run, rec->st.finish);
+		for (m = 0; m < NR_STATS; m++)
+			fprintf(file, ", \"%s\": %lu",
+				metric_names[m], stats_metric(rec, m));
+		fprintf(file, "}");
+	}
+
+	fprintf(file, "\n  ],\n  \"summary\": {");
+	for (m = 0; nr_recs > 0 && m < NR_STATS; m++) {
+		stats_summary(m, pct, &mean);
+		fprintf(file, "%s\n    \"%s\": {", m ? "," : "", metric_names[m]);
+		for (i = 0; i < NR_PERCENTILES; i++)
+			fprintf(file, "\"p%d\": %lu, ", percentiles[i], pct[i]);
+		fprintf(file, "\"mean\": %.2f}", mean);
+	}
+
+	fprintf(file, "\n  },\n  \"cpus\": [");
+	for (i = 0; i < nr_cpus; i++)
+		fprintf(file, "%s\n    {\"cpu\": %d, \"busy\": %lu, "
+			"\"utilization\": %.4f}", i ? "," : "", i, cpu_busy[i].slots,
+			span ? (double)cpu_busy[i].slots / span : 0.0);
+	fprintf(file, "\n  ]\n}\n");
+}
+
+int stats_dump(const char * path) {
+	uint64_t span = 0;
+	size_t len = strlen(path);
+	FILE * file;
+	int i;
+
+	/* The timer is stopped by now, the run lasted until the last
+	 * process finished */
+	for (i = 0; i < nr_recs; i++)
+		if (recs[i].st.finish > span)
+			span = recs[i].st.finish;
+
+	if ((file = fopen(path, "w")) == NULL) {
+		fprintf(stderr, "stats: cannot write %s\n", path);
+	} else {
+		if (len >= 5 && strcmp(path + len - 5, ".json") == 0)
+			dump_json(file, span);
+		else
+			dump_csv(file, span);
+		fclose(file);
+	}
+
+	free(recs);
+	free(cpu_busy);
+	recs = NULL;
+	cpu_busy = NULL;
+	nr_recs = max_recs = nr_cpus = 0;
+	return (file == NULL) ? -1 : 0;
+}
+
+#endif /* SCHED_STATS */
+
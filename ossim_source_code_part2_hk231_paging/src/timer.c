@@ -1,7 +1,15 @@
 
 #include "timer.h"
+#include "log.h"
 #include <stdio.h>
 #include <stdlib.h>
+#include <limits.h>
+#include <unistd.h>
+#include <sys/syscall.h>
+#include <linux/futex.h>
+
+/* Number of polls before a waiter falls back to sleeping in the kernel */
+#define TIMER_SPIN 2000
 
 static pthread_t _timer;
 
@@ -12,84 +20,132 @@ struct timer_id_container_t {
 
 static struct timer_id_container_t * dev_list = NULL;
 
+/* Tick barrier shared by the timer and all devices */
+static struct {
+	int nr_active;	// Attached devices which are not finished
+	int pending;	// Devices still working in the current slot
+	int sense;	// Flipped by the timer to release a slot
+	uint64_t wake;	// Earliest slot some device has work at
+} tick;
+
 static uint64_t _time;
 
 static int timer_started = 0;
 static int timer_stop = 0;
+static int spin_limit = 0;
+
+static inline void cpu_relax(void) {
+#if defined(__x86_64__) || defined(__i386__)
+	__asm__ __volatile__("pause");
+#endif
+}
+
+static void futex_wait(int * addr, int val) {
+	syscall(SYS_futex, addr, FUTEX_WAIT_PRIVATE, val, NULL, NULL, 0);
+}
+
+static void futex_wake(int * addr) {
+	syscall(SYS_futex, addr, FUTEX_WAKE_PRIVATE, INT_MAX, NULL, NULL, 0);
+}
+
+/* Spin for a while, then sleep until *addr is not [val] any more */
+static void wait_while(int * addr, int val) {
+	int spin;
+	for (spin = 0; spin < spin_limit; spin++) {
+		if (__atomic_load_n(addr, __ATOMIC_ACQUIRE) != val)
+			return;
+		cpu_relax();
+	}
+	while (__atomic_load_n(addr, __ATOMIC_ACQUIRE) == val)
+		futex_wait(addr, val);
+}
+
+/* Lower tick.wake to [slot] */
+static void tick_wake_at(uint64_t slot) {
+	uint64_t cur = __atomic_load_n(&tick.wake, __ATOMIC_RELAXED);
+	while (slot < cur && !__atomic_compare_exchange_n(&tick.wake, &cur,
+			slot, 1, __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+		;
+}
 
+/* A device is done with the current slot, the last one wakes the timer */
+static void tick_arrive(void) {
+	if (__atomic_sub_fetch(&tick.pending, 1, __ATOMIC_ACQ_REL) == 0)
+		futex_wake(&tick.pending);
+}
 
 static void * timer_routine(void * args) {
 	while (!timer_stop) {
-		printf("Time slot %3lu\n", current_time());
-		int fsh = 0;
-		int event = 0;
 		/* Wait for all devices have done the job in current
 		 * time slot */
-		struct timer_id_container_t * temp;
-		for (temp = dev_list; temp != NULL; temp = temp->next) {
-			pthread_mutex_lock(&temp->id.event_lock);
-			while (!temp->id.done && !temp->id.fsh) {
-				pthread_cond_wait(
-					&temp->id.event_cond,
-					&temp->id.event_lock
-				);
-			}
-			if (temp->id.fsh) {
-				fsh++;
-			}
-			event++;
-			pthread_mutex_unlock(&temp->id.event_lock);
+		int pending;
+		while ((pending = __atomic_load_n(&tick.pending,
+				__ATOMIC_ACQUIRE)) != 0)
+			wait_while(&tick.pending, pending);
+
+		/* Increase the time slot, or warp to the first slot having
+		 * work when every device is idle */
+		uint64_t wake = __atomic_load_n(&tick.wake, __ATOMIC_RELAXED);
+		if (wake != TIMER_NEVER && wake > _time + 1)
+			set_current_time(wake);
+		else
+			set_current_time(_time + 1);
+		tick.wake = TIMER_NEVER;
+
+		int active = __atomic_load_n(&tick.nr_active, __ATOMIC_ACQUIRE);
+		if (active == 0) {
+			break;
 		}
 
-		/* Increase the time slot */
-		_time++;
+		/* Logged before any device runs in the new slot */
+		log_printf("Time slot %3lu\n", current_time());
 
 		/* Let devices continue their job */
-		for (temp = dev_list; temp != NULL; temp = temp->next) {
-			pthread_mutex_lock(&temp->id.timer_lock);
-			temp->id.done = 0;
-			pthread_cond_signal(&temp->id.timer_cond);
-			pthread_mutex_unlock(&temp->id.timer_lock);
-		}
-		if (fsh == event) {
-			break;
-		}
+		__atomic_store_n(&tick.pending, active, __ATOMIC_RELAXED);
+		__atomic_store_n(&tick.sense, !tick.sense, __ATOMIC_RELEASE);
+		futex_wake(&tick.sense);
 	}
 	pthread_exit(args);
 }
 
 void next_slot(struct timer_id_t * timer_id) {
+	next_slot_until(timer_id, 0);
+}
+
+void next_slot_until(struct timer_id_t * timer_id, uint64_t slot) {
 	/* Tell to timer that we have done our job in current slot */
-	pthread_mutex_lock(&timer_id->event_lock);
-	timer_id->done = 1;
-	pthread_cond_signal(&timer_id->event_cond);
-	pthread_mutex_unlock(&timer_id->event_lock);
+	timer_id->sense = !timer_id->sense;
+	tick_wake_at(slot);
+	tick_arrive();
 
 	/* Wait for going to next slot */
-	pthread_mutex_lock(&timer_id->timer_lock);
-	while (timer_id->done) {
-		pthread_cond_wait(
-			&timer_id->timer_cond,
-			&timer_id->timer_lock
-		);
-	}
-	pthread_mutex_unlock(&timer_id->timer_lock);
+	wait_while(&tick.sense, !timer_id->sense);
 }
 
 uint64_t current_time() {
-	return _time;
+	return __atomic_load_n(&_time, __ATOMIC_ACQUIRE);
+}
+
+void set_current_time(uint64_t time) {
+	__atomic_store_n(&_time, time, __ATOMIC_RELEASE);
 }
 
 void start_timer() {
 	timer_started = 1;
+	spin_limit = (sysconf(_SC_NPROCESSORS_ONLN) > 1) ? TIMER_SPIN : 0;
+	tick.pending = tick.nr_active;
+	tick.sense = 0;
+	tick.wake = TIMER_NEVER;
+	log_printf("Time slot %3lu\n", current_time());
 	pthread_create(&_timer, NULL, timer_routine, NULL);
 }
 
 void detach_event(struct timer_id_t * event) {
-	pthread_mutex_lock(&event->event_lock);
 	event->fsh = 1;
-	pthread_cond_signal(&event->event_cond);
-	pthread_mutex_unlock(&event->event_lock);
+	/* Leave the barrier before arriving, the timer must not count us
+	 * again once it sees the slot completed */
+	__atomic_sub_fetch(&tick.nr_active, 1, __ATOMIC_ACQ_REL);
+	tick_arrive();
 }
 
 struct timer_id_t * attach_event() {
@@ -100,12 +156,9 @@ struct timer_id_t * attach_event() {
 			(struct timer_id_container_t*)malloc(
 				sizeof(struct timer_id_container_t)
 			);
-		container->id.done = 0;
+		container->id.sense = 0;
 		container->id.fsh = 0;
-		pthread_cond_init(&container->id.event_cond, NULL);
-		pthread_mutex_init(&container->id.event_lock, NULL);
-		pthread_cond_init(&container->id.timer_cond, NULL);
-		pthread_mutex_init(&container->id.timer_lock, NULL);
+		tick.nr_active++;
 		if (dev_list == NULL) {
 			dev_list = container;
 			dev_list->next = NULL;
@@ -123,10 +176,12 @@ void stop_timer() {
 	while (dev_list != NULL) {
 		struct timer_id_container_t * temp = dev_list;
 		dev_list = dev_list->next;
-		pthread_cond_destroy(&temp->id.event_cond);
-		pthread_mutex_destroy(&temp->id.event_lock);
-		pthread_cond_destroy(&temp->id.timer_cond);
-		pthread_mutex_destroy(&temp->id.timer_lock);
 		free(temp);
 	}
+	/* Allow the timer to be started again */
+	timer_started = 0;
+	timer_stop = 0;
+	tick.nr_active = 0;
+	set_current_time(0);
 }
+